@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2025 Ivan Gaydardzhiev
+ * Licensed under the GPL-3.0-only
+ */
+
+/*
+ * Shared by the benchmarks: links the interpreter's internals in and
+ * generates their common input, so lexbench and microbench measure the
+ * same program. Timing uses the interpreter's own now_ms().
+ */
+
+#define main slug_main
+#include "../slug.c"
+#undef main
+
+/* valid statements heavy on long identifiers and keywords */
+static char* gen_program(size_t target, size_t* len) {
+	static const char* lines[] = {
+		"var accumulator_total = accumulator_total + 1024 * counter_value;\n",
+		"if (counter_value <= limit_of_iteration) { outn(counter_value); } elif (finished_flag == false || other_value != 42) { result = -result; } else { result = 0; }\n",
+		"const multiplier = func(left_operand, right_operand) => left_operand * right_operand;\n",
+		"while (index_position < 1000000 && !finished_flag) { index_position = index_position + 1; }\n",
+		"for position in 0..4096 { checksum = (checksum * 31 + position) % 65521; }\n",
+		"outn(multiplier(accumulator_total, checksum - 7));\n",
+	};
+	size_t nl=sizeof lines/sizeof lines[0];
+	char* s=(char*)malloc(target+256);
+	if(!s) die("out of memory");
+	size_t n=0;
+	for(size_t i=0; n<target; i++) {
+		const char* l=lines[i%nl];
+		size_t k=strlen(l);
+		memcpy(s+n, l, k);
+		n+=k;
+	}
+	s[n]='\0';
+	*len=n;
+	return s;
+}
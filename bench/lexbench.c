@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2025 Ivan Gaydardzhiev
+ * Licensed under the GPL-3.0-only
+ */
+
+/*
+ * Tokenizer throughput microbenchmark. Tokenizes the program the
+ * microbenchmarks parse, scaled to 64 MB, and reports the best of several
+ * tokenize() runs over it.
+ */
+
+#include "bench.h"
+
+int main(int argc, char** argv) {
+	size_t mb = argc>1? (size_t)atoi(argv[1]) : 64;
+	size_t len;
+	char* src=gen_program(mb<<20, &len);
+	double cold=1e9, warm=1e9;
+	size_t ntok=0;
+	for(int r=0; r<5; r++) {
+		TokVec tv;
+		double t0=now_ms();
+		tokenize(src, &tv);
+		double t=now_ms()-t0;
+		if(t<cold) cold=t;
+		ntok=tv.n;
+		/* warm: relex into the already faulted token buffer */
+		tv.n=0;
+		t0=now_ms();
+		lex_into(src, len, &tv);
+		t=now_ms()-t0;
+		if(t<warm) warm=t;
+		tv_free(&tv);
+	}
+	printf("lex cold: %zu bytes %zu tokens simd=%d best %.3f ms  %.1f MB/s  %.1f ns/token\n",
+	       len, ntok, LEX_SIMD, cold, len/cold/1e3, cold*1e6/ntok);
+	printf("lex warm: %zu bytes %zu tokens simd=%d best %.3f ms  %.1f MB/s  %.1f ns/token\n",
+	       len, ntok, LEX_SIMD, warm, len/warm/1e3, warm*1e6/ntok);
+	free(src);
+	return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2025 Ivan Gaydardzhiev
+ * Licensed under the GPL-3.0-only
+ */
+
+/*
+ * Component microbenchmarks. Links the interpreter's internals and times
+ * the tokenizer, parser, environment lookups and evaluator separately on
+ * synthetic inputs, so a slowdown can be pinned on one of them. Every
+ * row is the best of several runs and has the same columns:
+ *
+ *   component  workload  ops  ns/op  B/op  throughput
+ *
+ * Timed runs use the lean evaluator and lookups that plain runs get.
+ * Ops and B/op come from one extra run on the instrumented variant and
+ * the interpreter's allocation counters; the tokenizer row counts its
+ * token buffer instead.
+ */
+
+#include "bench.h"
+
+#define RUNS 5
+
+/* lookups feed it so they cannot be optimised away */
+static volatile unsigned long long sink;
+
+typedef struct {
+	double ms;
+	unsigned long long bytes;
+} Sample;
+
+static unsigned long long alloc_bytes(void) {
+	unsigned long long n=0;
+	for(int k=0; k<K_NKINDS; k++) n+=stats.bytes[k];
+	return n;
+}
+
+static void row(const char* comp, const char* work, unsigned long long ops, Sample s, double rate, const char* unit) {
+	printf("%-8s %-22s %12llu %10.1f %9.1f %10.1f %s\n", comp, work, ops, s.ms*1e6/ops, (double)s.bytes/ops, rate, unit);
+}
+
+static void keep_best(Sample* best, double ms, unsigned long long bytes) {
+	if(ms<best->ms) {
+		best->ms=ms;
+		best->bytes=bytes;
+	}
+}
+
+/* 'count' statements, each one expression nested 'depth' parentheses deep */
+static char* gen_nested(size_t depth, size_t count) {
+	size_t per=depth*4+16;
+	char* s=(char*)malloc(per*count+1);
+	size_t n=0;
+	for(size_t c=0; c<count; c++) {
+		n+=(size_t)sprintf(s+n, "x = ");
+		for(size_t i=0; i<depth; i++) s[n++]='(';
+		s[n++]='1';
+		for(size_t i=0; i<depth; i++) {
+			memcpy(s+n, "+1)", 3);
+			n+=3;
+		}
+		s[n++]=';';
+		s[n++]='\n';
+	}
+	s[n]='\0';
+	return s;
+}
+
+static void bench_lex(const char* src, size_t len) {
+	Sample best= {1e18, 0};
+	size_t ntok=0;
+	for(int r=0; r<RUNS; r++) {
+		TokVec tv;
+		double t0=now_ms();
+		tokenize(src, &tv);
+		keep_best(&best, now_ms()-t0, tv.cap*sizeof(Token));
+		ntok=tv.n;
+		tv_free(&tv);
+	}
+	char work[64];
+	snprintf(work, sizeof work, "%.1f MB program", len/1048576.0);
+	row("lex", work, ntok, best, len/best.ms/1e3, "MB/s");
+}
+
+static void bench_parse(const char* comp, const char* work, const char* src, size_t len) {
+	TokVec tv;
+	tokenize(src, &tv);
+	Sample best= {1e18, 0};
+	unsigned long long nodes=0;
+	for(int r=0; r<RUNS; r++) {
+		/* the trees are never freed, like the interpreter's */
+		unsigned long long n0=stats.allocs[K_AST], b0=alloc_bytes();
+		Parser P = { .toks=&tv, .i=0 };
+		double t0=now_ms();
+		(void)parse_program(&P);
+		keep_best(&best, now_ms()-t0, alloc_bytes()-b0);
+		nodes=stats.allocs[K_AST]-n0;
+	}
+	tv_free(&tv);
+	row(comp, work, nodes, best, len/best.ms/1e3, "MB/s");
+}
+
+static char** gen_names(const char* prefix, size_t n) {
+	char** names=(char**)malloc(n*sizeof(char*));
+	for(size_t i=0; i<n; i++) {
+		char buf[32];
+		snprintf(buf, sizeof buf, "%s_%zu", prefix, i);
+		names[i]=strdup(buf);
+	}
+	return names;
+}
+
+static void lookup_all(Env* e, char** names, size_t n, size_t rounds) {
+	for(size_t r=0; r<rounds; r++) {
+		for(size_t i=0; i<n; i++) sink+=(unsigned)env_find_lean(e, names[i])->val.as.i;
+	}
+}
+
+/* one Env with n bindings, the shape of a large global scope */
+static void bench_env_wide(size_t n, size_t rounds) {
+	char** names=gen_names("global_binding", n);
+	Sample def= {1e18, 0}, find= {1e18, 0};
+	unsigned long long b0=alloc_bytes();
+	Env* e=env_new(NULL);
+	for(size_t i=0; i<n; i++) env_define_instr(e, names[i], VNum((int)i), false);
+	unsigned long long bytes=alloc_bytes()-b0;
+	for(int r=0; r<RUNS; r++) {
+		double t0=now_ms();
+		e=env_new(NULL);
+		for(size_t i=0; i<n; i++) env_define_lean(e, names[i], VNum((int)i), false);
+		keep_best(&def, now_ms()-t0, bytes);
+		t0=now_ms();
+		lookup_all(e, names, n, rounds);
+		keep_best(&find, now_ms()-t0, 0);
+	}
+	char work[64];
+	snprintf(work, sizeof work, "define %zu", n);
+	row("env", work, n, def, n/def.ms/1e3, "Mops/s");
+	snprintf(work, sizeof work, "find in %zu", n);
+	row("env", work, (unsigned long long)n*rounds, find, n*rounds/find.ms/1e3, "Mops/s");
+}
+
+/* a chain of 'depth' Envs with one binding each, looked up from the innermost */
+static void bench_env_deep(size_t depth, size_t rounds) {
+	char** names=gen_names("frame_local", depth);
+	Env* e=NULL;
+	for(size_t i=0; i<depth; i++) {
+		e=env_new(e);
+		env_define_lean(e, names[i], VNum((int)i), false);
+	}
+	Sample find= {1e18, 0};
+	for(int r=0; r<RUNS; r++) {
+		double t0=now_ms();
+		lookup_all(e, names, depth, rounds);
+		keep_best(&find, now_ms()-t0, 0);
+	}
+	char work[64];
+	snprintf(work, sizeof work, "find in chain of %zu", depth);
+	row("env", work, (unsigned long long)depth*rounds, find, depth*rounds/find.ms/1e3, "Mops/s");
+}
+
+/* runs src the way main does at the default -O1; ops are calls, or nodes when calls is false */
+static void bench_eval(const char* work, const char* src, bool calls) {
+	TokVec tv;
+	tokenize(src, &tv);
+	Parser P = { .toks=&tv, .i=0 };
+	AST* prog=parse_program(&P);
+	capture_pass(prog, NULL);
+	type_pass(prog, false);
+	inline_pass(prog, false);
+	unsigned long long c0=stats.calls, n0=0, n1=0, b0=alloc_bytes();
+	for(int t=0; t<A_NTAGS; t++) n0+=stats.nodes[t];
+	(void)eval_instr(prog, env_new(NULL));
+	for(int t=0; t<A_NTAGS; t++) n1+=stats.nodes[t];
+	unsigned long long ops = calls? stats.calls-c0 : n1-n0;
+	Sample best= {1e18, alloc_bytes()-b0};
+	for(int r=0; r<RUNS; r++) {
+		Env* global=env_new(NULL);
+		double t0=now_ms();
+		(void)eval_lean(prog, global);
+		keep_best(&best, now_ms()-t0, best.bytes);
+	}
+	tv_free(&tv);
+	row("eval", work, ops, best, ops/best.ms/1e3, calls? "Mcalls/s" : "Mnodes/s");
+}
+
+int main(int argc, char** argv) {
+	size_t mb = argc>1? (size_t)atoi(argv[1]) : 4;
+	cclass_init();
+	size_t len;
+	char* src=gen_program(mb<<20, &len);
+	char* nested=gen_nested(2000, 200);
+	printf("%-8s %-22s %12s %10s %9s %10s\n", "comp", "workload", "ops", "ns/op", "B/op", "throughput");
+	bench_lex(src, len);
+	char work[64];
+	snprintf(work, sizeof work, "%.1f MB program", len/1048576.0);
+	bench_parse("parse", work, src, len);
+	bench_parse("parse", "nesting 2000 deep", nested, strlen(nested));
+	bench_env_wide(4096, 4);
+	bench_env_deep(1024, 16);
+	bench_eval("fib(24)", "var fib = func(n) => { if (n < 2) { n; } else { fib(n - 1) + fib(n - 2); } };\nfib(24);\n", true);
+	bench_eval("closure calls", "var add = func(a) => func(b) => a + b;\nvar inc = add(1);\nvar s = 0;\nfor i in 0..200000 { s = inc(s); }\n", true);
+	bench_eval("while loop", "var i = 0;\nvar s = 0;\nwhile (i < 1000000) { s = s + i % 7; i = i + 1; }\n", false);
+	free(nested);
+	free(src);
+	return 0;
+}
@@ -0,0 +1,567 @@
+/*
+ * Copyright (C) 2025 Ivan Gaydardzhiev
+ * Licensed under the GPL-3.0-only
+ */
+
+/*
+ * Differential fuzzer. Generates random well typed slug programs whose
+ * recursion and loops are bounded, runs each through every engine (the
+ * interpreter at -O0, the interpreter with its optimisation passes in
+ * each of its lean, guarded and instrumented evaluators, and the --emit-c
+ * compiler) and compares stdout, exit status and stderr with warnings
+ * stripped. A disagreement is minimised by deleting top level
+ * statements while it persists and written to fuzz/work/. The run
+ * time of each engine is summed over all programs and compared with the
+ * totals of the previous run, so slowdowns show up next to wrong output.
+ *
+ * usage: fuzz [-n programs] [-s first_seed] [-cc compiler] [-t timings]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#define WORK "fuzz/work"
+#define MAX_LINES 256
+#define MAX_VARS 32
+#define SLOWDOWN 1.15
+
+/* generator */
+static uint64_t rng;
+
+static unsigned rnd(unsigned n) {
+	rng^=rng<<13;
+	rng^=rng>>7;
+	rng^=rng<<17;
+	return (unsigned)(rng%n);
+}
+
+typedef struct {
+	char* s;
+	size_t n, cap;
+} Buf;
+
+static void bprintf(Buf* b, const char* fmt, ...) {
+	va_list ap, aq;
+	va_start(ap, fmt);
+	va_copy(aq, ap);
+	int k=vsnprintf(NULL, 0, fmt, aq);
+	va_end(aq);
+	if(b->n+(size_t)k+1>b->cap) {
+		while(b->n+(size_t)k+1>b->cap) b->cap = b->cap? b->cap*2 : 256;
+		b->s=(char*)realloc(b->s, b->cap);
+	}
+	vsnprintf(b->s+b->n, (size_t)k+1, fmt, ap);
+	b->n+=(size_t)k;
+	va_end(ap);
+}
+
+typedef struct {
+	char nums[MAX_VARS][16], bools[MAX_VARS][16];
+	int nnums, nbools;
+	int nrec, nhelp, nclos;
+	int uniq;
+	int loops;
+	/* parameters in scope while generating a function body */
+	const char* params[4];
+	int nparams;
+} Gen;
+
+static void gen_num(Gen* g, Buf* b, int depth);
+static void gen_bool(Gen* g, Buf* b, int depth);
+
+static void gen_num(Gen* g, Buf* b, int depth) {
+	unsigned k = depth<=0? rnd(3) : rnd(12);
+	switch(k) {
+	case 0:
+		bprintf(b, "%u", rnd(100));
+		return;
+	case 1:
+		if(g->nparams) {
+			bprintf(b, "%s", g->params[rnd((unsigned)g->nparams)]);
+			return;
+		}
+	/* fallthrough */
+	case 2:
+		if(g->nnums) bprintf(b, "%s", g->nums[rnd((unsigned)g->nnums)]);
+		else bprintf(b, "%u", rnd(10));
+		return;
+	case 3:
+	case 4:
+	case 5: {
+		static const char* ops[] = { "+", "-", "*" };
+		bprintf(b, "(");
+		gen_num(g, b, depth-1);
+		bprintf(b, " %s ", ops[rnd(3)]);
+		gen_num(g, b, depth-1);
+		bprintf(b, ")");
+		return;
+	}
+	case 6:
+		/* the divisor is always in 2..14 */
+		bprintf(b, "(");
+		gen_num(g, b, depth-1);
+		bprintf(b, " %s (", rnd(2)? "/" : "%");
+		gen_num(g, b, depth-1);
+		bprintf(b, " %% 7 + 8))");
+		return;
+	case 7:
+		bprintf(b, "-");
+		gen_num(g, b, 0);
+		return;
+	case 8:
+		if(g->nrec && !g->nparams) {
+			bprintf(b, "rec%u(%u, ", rnd((unsigned)g->nrec), rnd(6));
+			gen_num(g, b, depth-1);
+			bprintf(b, ")");
+			return;
+		}
+	/* fallthrough */
+	case 9:
+		if(g->nhelp) {
+			bprintf(b, "help%u(", rnd((unsigned)g->nhelp));
+			gen_num(g, b, depth-1);
+			bprintf(b, ")");
+			return;
+		}
+	/* fallthrough */
+	case 10:
+		if(g->nclos && !g->nparams) {
+			bprintf(b, "clos%u(", rnd((unsigned)g->nclos));
+			gen_num(g, b, depth-1);
+			bprintf(b, ")");
+			return;
+		}
+	/* fallthrough */
+	default:
+		if(g->nrec && !g->nparams) {
+			bprintf(b, "apply(rec%u, %u, ", rnd((unsigned)g->nrec), rnd(4));
+			gen_num(g, b, depth-1);
+			bprintf(b, ")");
+			return;
+		}
+		bprintf(b, "%u", rnd(1000));
+		return;
+	}
+}
+
+static void gen_bool(Gen* g, Buf* b, int depth) {
+	unsigned k = depth<=0? rnd(2) : rnd(7);
+	switch(k) {
+	case 0:
+		bprintf(b, rnd(2)? "true" : "false");
+		return;
+	case 1:
+		if(g->nbools) bprintf(b, "%s", g->bools[rnd((unsigned)g->nbools)]);
+		else bprintf(b, "true");
+		return;
+	case 2:
+	case 3: {
+		static const char* ops[] = { "<", "<=", ">", ">=", "==", "!=" };
+		bprintf(b, "(");
+		gen_num(g, b, depth-1);
+		bprintf(b, " %s ", ops[rnd(6)]);
+		gen_num(g, b, depth-1);
+		bprintf(b, ")");
+		return;
+	}
+	case 4:
+	case 5:
+		bprintf(b, "(");
+		gen_bool(g, b, depth-1);
+		bprintf(b, " %s ", rnd(2)? "&&" : "||");
+		gen_bool(g, b, depth-1);
+		bprintf(b, ")");
+		return;
+	default:
+		bprintf(b, "!");
+		gen_bool(g, b, 0);
+		return;
+	}
+}
+
+static void gen_stmt(Gen* g, Buf* b, int depth);
+
+static void gen_body(Gen* g, Buf* b, int depth) {
+	bprintf(b, "{ ");
+	for(unsigned i=0, n=1+rnd(3); i<n; i++) gen_stmt(g, b, depth-1);
+	bprintf(b, "}");
+}
+
+static void gen_stmt(Gen* g, Buf* b, int depth) {
+	unsigned k = depth<=0? rnd(4) : rnd(8);
+	switch(k) {
+	case 0:
+		bprintf(b, "outn(");
+		if(rnd(3)) gen_num(g, b, 3);
+		else gen_bool(g, b, 3);
+		bprintf(b, "); ");
+		return;
+	case 1:
+		if(g->nnums) {
+			bprintf(b, "%s = ", g->nums[rnd((unsigned)g->nnums)]);
+			gen_num(g, b, 3);
+			bprintf(b, "; ");
+			return;
+		}
+	/* fallthrough */
+	case 2:
+		/* only top level declarations are certain to have run */
+		if(g->nnums<MAX_VARS && depth==3) {
+			char name[16];
+			snprintf(name, sizeof name, "n%d", g->uniq++);
+			bprintf(b, "var %s = ", name);
+			gen_num(g, b, 3);
+			bprintf(b, "; ");
+			strcpy(g->nums[g->nnums++], name);
+			return;
+		}
+	/* fallthrough */
+	case 3:
+		if(g->nbools<MAX_VARS && depth==3) {
+			char name[16];
+			snprintf(name, sizeof name, "b%d", g->uniq++);
+			bprintf(b, "var %s = ", name);
+			gen_bool(g, b, 2);
+			bprintf(b, "; ");
+			strcpy(g->bools[g->nbools++], name);
+			return;
+		}
+		bprintf(b, "outn(true); ");
+		return;
+	case 4:
+	case 5:
+		bprintf(b, "if (");
+		gen_bool(g, b, 2);
+		bprintf(b, ") ");
+		gen_body(g, b, depth);
+		if(rnd(2)) {
+			bprintf(b, " else ");
+			gen_body(g, b, depth);
+		}
+		bprintf(b, " ");
+		return;
+	case 6:
+		if(g->loops>=2) return;
+		g->loops++;
+		bprintf(b, "for i%d in %u..%u ", g->uniq++, rnd(10), rnd(40));
+		gen_body(g, b, depth);
+		bprintf(b, " ");
+		g->loops--;
+		return;
+	default: {
+		if(g->loops>=2) return;
+		g->loops++;
+		int w=g->uniq++;
+		bprintf(b, "var w%d = 0; while (w%d < %u) { w%d = w%d + 1; ", w, w, rnd(30), w, w);
+		for(unsigned i=0, n=1+rnd(2); i<n; i++) gen_stmt(g, b, depth-1);
+		bprintf(b, "} ");
+		g->loops--;
+		return;
+	}
+	}
+}
+
+/* one top level statement per line, so minimisation can drop lines */
+static char* gen_program(uint64_t seed, size_t* len) {
+	Gen g= {0};
+	Buf b= {0};
+	rng=seed*0x9E3779B97F4A7C15ull+1;
+	bprintf(&b, "var apply = func(f, d, x) => { f(d, x); };\n");
+	for(int i=0, n=(int)rnd(3); i<n; i++) {
+		char p[16];
+		snprintf(p, sizeof p, "hp%d", i);
+		g.params[0]=p;
+		g.nparams=1;
+		bprintf(&b, "var help%d = func(hp%d) => { ", i, i);
+		gen_num(&g, &b, 2);
+		bprintf(&b, "; };\n");
+		g.nparams=0;
+		g.nhelp++;
+	}
+	for(int i=0, n=(int)rnd(3); i<n; i++) {
+		char d[16], x[16];
+		snprintf(d, sizeof d, "rd%d", i);
+		snprintf(x, sizeof x, "rx%d", i);
+		g.params[0]=d;
+		g.params[1]=x;
+		g.nparams=2;
+		bprintf(&b, "var rec%d = func(%s, %s) => { if (%s > 0) { rec%d(%s - 1, ", i, d, x, d, i, d);
+		gen_num(&g, &b, 2);
+		bprintf(&b, ") + %s; } else { ", x);
+		gen_num(&g, &b, 2);
+		bprintf(&b, "; } };\n");
+		g.nparams=0;
+		g.nrec++;
+	}
+	for(int i=0, n=(int)rnd(2); i<n; i++) {
+		bprintf(&b, "var mk%d = func(mc%d) => { func(mz%d) => { mz%d * 2 + mc%d; }; };\n", i, i, i, i, i);
+		bprintf(&b, "var clos%d = mk%d(", i, i);
+		gen_num(&g, &b, 2);
+		bprintf(&b, ");\n");
+		g.nclos++;
+	}
+	for(unsigned i=0, n=10+rnd(30); i<n; i++) {
+		gen_stmt(&g, &b, 3);
+		bprintf(&b, "\n");
+	}
+	*len=b.n;
+	return b.s;
+}
+
+/* engines */
+typedef struct {
+	const char* name;
+	bool compiled;
+	const char* flag;
+	double total;
+} Engine;
+
+static Engine engines[] = {
+	{ "O0", false, "-O0", 0 },
+	{ "O1", false, NULL, 0 },
+	/* the other two copies of slug_eval.h; a budget no program reaches selects the guarded one */
+	{ "guard", false, "--max-steps=1000000000000", 0 },
+	{ "instr", false, "--instrumented", 0 },
+	{ "aot", true, NULL, 0 },
+};
+#define NENGINES (sizeof engines/sizeof engines[0])
+
+static const char* cc = "cc";
+
+typedef struct {
+	char* out;
+	char* err;
+	int status;
+	double secs;
+} Result;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static char* slurp(const char* path) {
+	FILE* f=fopen(path, "rb");
+	if(!f) return strdup("");
+	Buf b= {0};
+	char chunk[4096];
+	size_t k;
+	bprintf(&b, "%s", "");
+	while((k=fread(chunk, 1, sizeof chunk, f))>0) bprintf(&b, "%.*s", (int)k, chunk);
+	fclose(f);
+	return b.s;
+}
+
+static void spit(const char* path, const char* s, size_t n) {
+	FILE* f=fopen(path, "wb");
+	if(!f) {
+		perror(path);
+		exit(2);
+	}
+	fwrite(s, 1, n, f);
+	fclose(f);
+}
+
+/* runs argv with stdout and stderr sent to files, capped at five CPU seconds */
+static int run(char* const* argv, const char* out, const char* err, double* secs) {
+	double t0=now();
+	pid_t pid=fork();
+	if(pid<0) {
+		perror("fork");
+		exit(2);
+	}
+	if(pid==0) {
+		struct rlimit rl= {5, 5};
+		setrlimit(RLIMIT_CPU, &rl);
+		int o=open(out, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		int e=open(err, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if(o<0 || e<0) _exit(127);
+		dup2(o, 1);
+		dup2(e, 2);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	int st;
+	waitpid(pid, &st, 0);
+	if(secs) *secs=now()-t0;
+	return WIFEXITED(st)? WEXITSTATUS(st) : 128+WTERMSIG(st);
+}
+
+/* stderr without the type checker's warnings, which only -O1 prints */
+static void strip_warnings(char* s) {
+	char* w=s;
+	for(char* r=s; *r;) {
+		char* nl=strchr(r, '\n');
+		size_t k = nl? (size_t)(nl-r)+1 : strlen(r);
+		if(strncmp(r, "warning:", 8)!=0) {
+			memmove(w, r, k);
+			w+=k;
+		}
+		r+=k;
+	}
+	*w='\0';
+}
+
+static Result run_engine(Engine* e) {
+	Result r= {0};
+	char* argv[4];
+	int argc=0;
+	if(e->compiled) {
+		static char* emit[] = { "./slug", "--emit-c", WORK "/prog.slg", NULL };
+		if(run(emit, WORK "/prog.c", WORK "/err", NULL)!=0) {
+			r.out=strdup("");
+			r.err=slurp(WORK "/err");
+			r.status=-1;
+			return r;
+		}
+		char cmd[512];
+		snprintf(cmd, sizeof cmd, "%s -O2 -I. -w -o " WORK "/prog " WORK "/prog.c", cc);
+		if(system(cmd)!=0) {
+			r.out=strdup("");
+			r.err=strdup("compile failed\n");
+			r.status=-1;
+			return r;
+		}
+		argv[argc++]=WORK "/prog";
+	} else {
+		argv[argc++]="./slug";
+		if(e->flag) argv[argc++]=(char*)e->flag;
+		argv[argc++]=WORK "/prog.slg";
+	}
+	argv[argc]=NULL;
+	r.status=run(argv, WORK "/out", WORK "/err", &r.secs);
+	r.out=slurp(WORK "/out");
+	r.err=slurp(WORK "/err");
+	strip_warnings(r.err);
+	return r;
+}
+
+static void result_free(Result* r) {
+	free(r->out);
+	free(r->err);
+}
+
+/* runs src through every engine; returns the index of the first engine that disagrees with engines[0] */
+static size_t differs(const char* src, size_t n, bool timed) {
+	spit(WORK "/prog.slg", src, n);
+	Result ref=run_engine(&engines[0]);
+	if(timed) engines[0].total+=ref.secs;
+	size_t bad=0;
+	for(size_t i=1; i<NENGINES && !bad; i++) {
+		Result r=run_engine(&engines[i]);
+		if(timed) engines[i].total+=r.secs;
+		if(r.status!=ref.status || strcmp(r.out, ref.out)!=0 || strcmp(r.err, ref.err)!=0) bad=i;
+		result_free(&r);
+	}
+	result_free(&ref);
+	return bad;
+}
+
+/* deletes chunks of lines, halving the chunk size, while the engines still disagree */
+static char* minimise(const char* src, size_t* len) {
+	char* lines[MAX_LINES];
+	size_t nl=0;
+	char* copy=strdup(src);
+	for(char* l=strtok(copy, "\n"); l && nl<MAX_LINES; l=strtok(NULL, "\n")) lines[nl++]=l;
+	bool keep[MAX_LINES];
+	for(size_t i=0; i<nl; i++) keep[i]=true;
+	Buf b= {0};
+	bool progress=true;
+	while(progress) {
+		progress=false;
+		for(size_t chunk=nl/2; chunk>=1; chunk = chunk>1? chunk/2 : 0) {
+			for(size_t at=0; at<nl; at+=chunk) {
+				bool saved[MAX_LINES];
+				memcpy(saved, keep, sizeof keep);
+				bool any=false;
+				for(size_t i=at; i<at+chunk && i<nl; i++) {
+					any|=keep[i];
+					keep[i]=false;
+				}
+				if(!any) continue;
+				b.n=0;
+				bprintf(&b, "%s", "");
+				for(size_t i=0; i<nl; i++) if(keep[i]) bprintf(&b, "%s\n", lines[i]);
+				if(differs(b.s, b.n, false)) progress=true;
+				else memcpy(keep, saved, sizeof keep);
+			}
+		}
+	}
+	b.n=0;
+	bprintf(&b, "%s", "");
+	for(size_t i=0; i<nl; i++) if(keep[i]) bprintf(&b, "%s\n", lines[i]);
+	free(copy);
+	*len=b.n;
+	return b.s;
+}
+
+static void timings(const char* path) {
+	double prev[NENGINES]= {0};
+	FILE* f=fopen(path, "r");
+	if(f) {
+		char name[32];
+		double ms;
+		while(fscanf(f, "%31s %lf", name, &ms)==2) {
+			for(size_t i=0; i<NENGINES; i++) if(strcmp(name, engines[i].name)==0) prev[i]=ms;
+		}
+		fclose(f);
+	}
+	f=fopen(path, "w");
+	for(size_t i=0; i<NENGINES; i++) {
+		double ms=engines[i].total*1e3;
+		printf("%-5s %10.1f ms", engines[i].name, ms);
+		if(prev[i]>0) printf("  (previous %.1f ms, %+.1f%%)%s", prev[i], (ms/prev[i]-1)*100, ms>prev[i]*SLOWDOWN? "  SLOWER" : "");
+		printf("\n");
+		if(f) fprintf(f, "%s %.1f\n", engines[i].name, ms);
+	}
+	if(f) fclose(f);
+}
+
+int main(int argc, char** argv) {
+	unsigned long n=100, seed=1;
+	const char* tpath=WORK "/timings";
+	for(int i=1; i<argc; i++) {
+		if(strcmp(argv[i], "-n")==0 && i+1<argc) n=strtoul(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "-s")==0 && i+1<argc) seed=strtoul(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "-cc")==0 && i+1<argc) cc=argv[++i];
+		else if(strcmp(argv[i], "-t")==0 && i+1<argc) tpath=argv[++i];
+		else {
+			fprintf(stderr, "usage: %s [-n programs] [-s first_seed] [-cc compiler] [-t timings]\n", argv[0]);
+			return 2;
+		}
+	}
+	mkdir(WORK, 0755);
+	unsigned long failures=0;
+	for(unsigned long s=seed; s<seed+n; s++) {
+		size_t len;
+		char* src=gen_program(s, &len);
+		size_t bad=differs(src, len, true);
+		if(bad) {
+			failures++;
+			size_t mlen;
+			char* min=minimise(src, &mlen);
+			char path[256];
+			snprintf(path, sizeof path, WORK "/fail-%lu.slg", s);
+			spit(path, src, len);
+			snprintf(path, sizeof path, WORK "/fail-%lu-min.slg", s);
+			spit(path, min, mlen);
+			printf("seed %lu: %s disagrees with %s, minimised to %s\n", s, engines[bad].name, engines[0].name, path);
+			free(min);
+		}
+		free(src);
+	}
+	printf("%lu program%s, %lu mismatch%s\n", n, n==1? "" : "s", failures, failures==1? "" : "es");
+	timings(tpath);
+	return failures? 1 : 0;
+}
@@ -7,22 +7,59 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-#include <ctype.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <time.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#ifndef GEN_ASM
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__TINYC__)
+#define GEN_ASM 1
+#else
+#define GEN_ASM 0
+#endif
+#endif
+#if !GEN_ASM
+#include <pthread.h>
+#endif
+
+/* set by the REPL so that errors abandon the current input only */
+static jmp_buf* die_jmp = NULL;
+
+static void die_exit(void) {
+	if(die_jmp) longjmp(*die_jmp, 1);
+	exit(EXIT_FAILURE);
+}
 
 static void die(const char* msg) {
+	fflush(stdout);
 	fprintf(stderr, "runtime error: %s\n", msg);
-	exit(EXIT_FAILURE);
+	die_exit();
 }
 
 static void dief(const char* fmt, ...) {
 	va_list ap;
 	va_start(ap, fmt);
+	fflush(stdout);
 	fprintf(stderr, "runtime error: ");
 	vfprintf(stderr, fmt, ap);
 	fprintf(stderr, "\n");
 	va_end(ap);
-	exit(EXIT_FAILURE);
+	die_exit();
 }
 
 typedef enum {
@@ -35,12 +72,21 @@ typedef enum {
 	T_ELSE,
 	T_ELIF,
 	T_WHILE,
+	T_FOR,
+	T_IN,
+	T_DOTDOT,
 	T_FUNC,
 	T_ARROW,
 	T_OUTN,
+	T_YIELD,
+	T_IMPORT,
+	T_STR,
 	T_SEMI,
 	T_LBRACE,
 	T_RBRACE,
+	T_LBRACKET,
+	T_RBRACKET,
+	T_COLON,
 	T_LP,
 	T_RP,
 	T_PLUS,
@@ -65,264 +111,354 @@ typedef enum {
 typedef struct {
 	Tok t;
 	int ival;
-	char* sval;
+	uint32_t off;
+	uint32_t len;
 } Token;
 
+/*
+ * Tokens carry only their offset. Line numbers are recovered on demand
+ * from a table of newline offsets, built on the first query and walked
+ * with a cursor, since the parser asks for lines in nearly source order.
+ */
 typedef struct {
 	Token* data;
 	size_t n, cap;
+	const char* src;
+	uint32_t* nl;
+	size_t nnl, ncur;
 } TokVec;
 
 static void tv_init(TokVec* v) {
 	v->data=NULL;
 	v->n=0;
 	v->cap=0;
+	v->src=NULL;
+	v->nl=NULL;
+	v->nnl=0;
+	v->ncur=0;
 }
-static void tv_push(TokVec* v, Token tk) {
-	if(v->n==v->cap) {
-		v->cap = v->cap? v->cap*2 : 64;
-		v->data = (Token*)realloc(v->data, v->cap*sizeof(Token));
-	}
+static void tv_grow(TokVec* v) {
+	v->cap = v->cap? v->cap*2 : 64;
+	v->data = (Token*)realloc(v->data, v->cap*sizeof(Token));
+	if(!v->data) die("out of memory");
+}
+static inline void tv_push(TokVec* v, Token tk) {
+	if(v->n==v->cap) tv_grow(v);
 	v->data[v->n++] = tk;
 }
 static void tv_free(TokVec* v) {
-	for(size_t i=0; i<v->n; i++) {
-		if(v->data[i].t==T_ID || v->data[i].t==T_BOOL) {
-			free(v->data[i].sval);
+	free(v->data);
+	free(v->nl);
+}
+
+static void tv_index_lines(TokVec* v) {
+	size_t n=0, cap=64;
+	v->nl=(uint32_t*)malloc(cap*sizeof(uint32_t));
+	if(!v->nl) die("out of memory");
+	for(const char* q=v->src; (q=strchr(q, '\n')); q++) {
+		if(n==cap) {
+			cap*=2;
+			v->nl=(uint32_t*)realloc(v->nl, cap*sizeof(uint32_t));
+			if(!v->nl) die("out of memory");
 		}
+		v->nl[n++]=(uint32_t)(q-v->src);
+	}
+	v->nnl=n;
+}
+
+/* one plus the number of newlines before the token */
+static uint32_t tv_line(TokVec* v, const Token* tk) {
+	if(!v->nl) tv_index_lines(v);
+	size_t k=v->ncur;
+	while(k<v->nnl && v->nl[k]<tk->off) k++;
+	while(k>0 && v->nl[k-1]>=tk->off) k--;
+	v->ncur=k;
+	return (uint32_t)k+1;
+}
+
+/*
+ * ASCII character classes. The lexer never consults the locale, so the
+ * table replaces isspace/isdigit/isalpha with one load per character.
+ */
+enum { C_SPACE=1, C_DIGIT=2, C_ALPHA=4 };
+
+static unsigned char cclass[256];
+
+static void cclass_init(void) {
+	if(cclass['_']) return;
+	for(int c=0; c<256; c++) {
+		unsigned char k=0;
+		if(c==' ' || (c>='\t' && c<='\r')) k|=C_SPACE;
+		if(c>='0' && c<='9') k|=C_DIGIT;
+		if(c=='_' || (c>='a' && c<='z') || (c>='A' && c<='Z')) k|=C_ALPHA;
+		cclass[c]=k;
 	}
-	free(v->data);
 }
 
-static bool isalpha_(char c) {
-	return (c=='_') || isalpha((unsigned char)c);
+/*
+ * Run scanners. With SSE2 each step classifies 16 bytes at once and the
+ * first byte outside the class is found with a bit scan; the scalar loop
+ * handles the tail and targets without SSE2.
+ */
+#if defined(__SSE2__) && !defined(__TINYC__)
+#include <emmintrin.h>
+#define LEX_SIMD 1
+
+static inline __m128i lex_range(__m128i x, char lo, char hi) {
+	return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8((char)(lo-1))),
+	                     _mm_cmplt_epi8(x, _mm_set1_epi8((char)(hi+1))));
 }
 
-static bool isalnum_(char c) {
-	return (c=='_') || isalnum((unsigned char)c);
+static inline __m128i lex_space16(__m128i x) {
+	return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), lex_range(x, '\t', '\r'));
 }
 
-static void tokenize(const char* src, TokVec* out) {
-	tv_init(out);
-	size_t i=0, n=strlen(src);
-	while(i<n) {
+static inline __m128i lex_digit16(__m128i x) {
+	return lex_range(x, '0', '9');
+}
+
+static inline __m128i lex_alnum16(__m128i x) {
+	/* folding bit 5 maps 'A'..'Z' onto 'a'..'z' and leaves digits alone */
+	__m128i m=lex_range(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z');
+	m=_mm_or_si128(m, lex_range(x, '0', '9'));
+	return _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+}
+
+/* single byte runs are the common case, so test one byte before a block */
+#define LEX_RUN(name, simd, cls) \
+static inline size_t name(const char* src, size_t i, size_t n) { \
+	if(i<n && !(cclass[(unsigned char)src[i]]&(cls))) return i; \
+	while(i+16<=n) { \
+		__m128i x=_mm_loadu_si128((const __m128i*)(src+i)); \
+		unsigned m=~(unsigned)_mm_movemask_epi8(simd(x)) & 0xFFFFu; \
+		if(m) return i+(size_t)__builtin_ctz(m); \
+		i+=16; \
+	} \
+	while(i<n && (cclass[(unsigned char)src[i]]&(cls))) i++; \
+	return i; \
+}
+LEX_RUN(skip_space, lex_space16, C_SPACE)
+LEX_RUN(skip_digits, lex_digit16, C_DIGIT)
+LEX_RUN(skip_alnum, lex_alnum16, C_ALPHA|C_DIGIT)
+#undef LEX_RUN
+#else
+#define LEX_SIMD 0
+#define LEX_RUN(name, cls) \
+static inline size_t name(const char* src, size_t i, size_t n) { \
+	while(i<n && (cclass[(unsigned char)src[i]]&(cls))) i++; \
+	return i; \
+}
+LEX_RUN(skip_space, C_SPACE)
+LEX_RUN(skip_digits, C_DIGIT)
+LEX_RUN(skip_alnum, C_ALPHA|C_DIGIT)
+#undef LEX_RUN
+#endif
+
+/*
+ * Keywords are recognised through a perfect hash over the first byte, the
+ * last byte and the length. The table is laid out at compile time; adding
+ * a keyword means checking that its slot is still free.
+ */
+#define KW_HASH(first, last, len) ((unsigned)((first) + 3*(last) + (len)) & 63)
+
+typedef struct {
+	const char* kw;
+	size_t len;
+	Tok t;
+} Keyword;
+
+static const Keyword keywords[64] = {
+	[KW_HASH('v','r',3)] = {"var", 3, T_LET},
+	[KW_HASH('c','t',5)] = {"const", 5, T_CONST},
+	[KW_HASH('i','f',2)] = {"if", 2, T_IF},
+	[KW_HASH('e','f',4)] = {"elif", 4, T_ELIF},
+	[KW_HASH('e','e',4)] = {"else", 4, T_ELSE},
+	[KW_HASH('w','e',5)] = {"while", 5, T_WHILE},
+	[KW_HASH('f','r',3)] = {"for", 3, T_FOR},
+	[KW_HASH('i','n',2)] = {"in", 2, T_IN},
+	[KW_HASH('f','c',4)] = {"func", 4, T_FUNC},
+	[KW_HASH('t','e',4)] = {"true", 4, T_BOOL},
+	[KW_HASH('f','e',5)] = {"false", 5, T_BOOL},
+	[KW_HASH('o','n',4)] = {"outn", 4, T_OUTN},
+	[KW_HASH('y','d',5)] = {"yield", 5, T_YIELD},
+	[KW_HASH('i','t',6)] = {"import", 6, T_IMPORT},
+};
+
+#define KW_MAXLEN 6
+
+static inline Tok keyword(const char* s, size_t len) {
+	if(len>KW_MAXLEN) return T_ID;
+	const Keyword* k=&keywords[KW_HASH((unsigned char)s[0], (unsigned char)s[len-1], len)];
+	if(k->len!=len) return T_ID;
+	for(size_t i=0; i<len; i++) if(k->kw[i]!=s[i]) return T_ID;
+	return k->t;
+}
+
+/*
+ * Identifier tokens record an offset into the source buffer instead of
+ * owning a copy, so the buffer must outlive the token vector.
+ */
+static void lex_into(const char* src, size_t n, TokVec* out) {
+	size_t i=0;
+	for(;;) {
+		i=skip_space(src, i, n);
+		if(i>=n) break;
 		char c=src[i];
-		if(isspace((unsigned char)c)) {
-			i++;
-			continue;
-		}
-		if(isdigit((unsigned char)c)) {
-			long v=0;
-			while(i<n && isdigit((unsigned char)src[i])) {
-				v = v*10 + (src[i]-'0');
-				i++;
-			}
-			Token tk = { .t=T_NUM, .ival=(int)v };
-			tv_push(out, tk);
-			continue;
-		}
-		if(isalpha_(c)) {
+		unsigned char k=cclass[(unsigned char)c];
+		if(k&C_DIGIT) {
 			size_t s=i;
-			i++;
-			while(i<n && isalnum_(src[i])) i++;
-			size_t len=i-s;
-			char* id=(char*)malloc(len+1);
-			memcpy(id, src+s, len);
-			id[len]='\0';
-			Tok t = T_ID;
-			if(strcmp(id,"var")==0) {
-				t=T_LET;
-			} else if(strcmp(id,"const")==0) {
-				t=T_CONST;
-			} else if(strcmp(id,"if")==0) {
-				t=T_IF;
-			} else if(strcmp(id,"elif")==0) {
-				t=T_ELIF;
-			} else if(strcmp(id,"else")==0) {
-				t=T_ELSE;
-			} else if(strcmp(id,"while")==0) {
-				t=T_WHILE;
-			} else if(strcmp(id,"func")==0) {
-				t=T_FUNC;
-			} else if(strcmp(id,"true")==0 || strcmp(id,"false")==0) {
-				t=T_BOOL;
-			} else if(strcmp(id,"outn")==0) {
-				t=T_OUTN;
-			}
-			Token tk= {0};
-			tk.t=t;
-			if(t==T_ID || t==T_BOOL) {
-				tk.sval=id;
-			} else {
-				free(id);
-			}
-			tv_push(out, tk);
-			continue;
-		}
-		if(c=='(') {
-			tv_push(out, (Token) {
-				.t=T_LP
-			});
-			i++;
-			continue;
-		}
-		if(c==')') {
-			tv_push(out, (Token) {
-				.t=T_RP
-			});
-			i++;
-			continue;
-		}
-		if(c=='{') {
-			tv_push(out, (Token) {
-				.t=T_LBRACE
-			});
-			i++;
-			continue;
-		}
-		if(c=='}') {
-			tv_push(out, (Token) {
-				.t=T_RBRACE
-			});
-			i++;
-			continue;
-		}
-		if(c==';') {
-			tv_push(out, (Token) {
-				.t=T_SEMI
-			});
-			i++;
-			continue;
-		}
-		if(c==',') {
-			tv_push(out, (Token) {
-				.t=T_COMMA
-			});
-			i++;
-			continue;
-		}
-		if(c=='+') {
-			tv_push(out, (Token) {
-				.t=T_PLUS
-			});
-			i++;
-			continue;
-		}
-		if(c=='-') {
-			tv_push(out, (Token) {
-				.t=T_MINUS
-			});
-			i++;
-			continue;
-		}
-		if(c=='*') {
+			i=skip_digits(src, i, n);
+			long v=0;
+			for(size_t j=s; j<i; j++) v = v*10 + (src[j]-'0');
 			tv_push(out, (Token) {
-				.t=T_STAR
+				.t=T_NUM, .ival=(int)v, .off=(uint32_t)s
 			});
-			i++;
 			continue;
 		}
-		if(c=='/') {
-			tv_push(out, (Token) {
-				.t=T_SLASH
-			});
-			i++;
+		if(k&C_ALPHA) {
+			size_t s=i;
+			i=skip_alnum(src, i+1, n);
+			Token tk= {.t=keyword(src+s, i-s), .off=(uint32_t)s, .len=(uint32_t)(i-s)};
+			if(tk.t==T_BOOL) tk.ival = src[s]=='t';
+			tv_push(out, tk);
 			continue;
 		}
-		if(c=='%') {
+		if(c=='"') {
+			size_t s=++i;
+			while(i<n && src[i]!='"' && src[i]!='\n') i++;
+			if(i>=n || src[i]!='"') die("unterminated string");
 			tv_push(out, (Token) {
-				.t=T_PERCENT
+				.t=T_STR, .off=(uint32_t)s, .len=(uint32_t)(i-s)
 			});
 			i++;
 			continue;
 		}
-		if(c=='!') {
-			if(i+1<n && src[i+1]=='=') {
-				tv_push(out,(Token) {
-					.t=T_NEQ
-				});
-				i+=2;
+		char d = i+1<n? src[i+1] : '\0';
+		Tok t;
+		size_t w=1;
+		switch(c) {
+		case '(':
+			t=T_LP;
+			break;
+		case ')':
+			t=T_RP;
+			break;
+		case '{':
+			t=T_LBRACE;
+			break;
+		case '}':
+			t=T_RBRACE;
+			break;
+		case '[':
+			t=T_LBRACKET;
+			break;
+		case ']':
+			t=T_RBRACKET;
+			break;
+		case ':':
+			t=T_COLON;
+			break;
+		case ';':
+			t=T_SEMI;
+			break;
+		case ',':
+			t=T_COMMA;
+			break;
+		case '+':
+			t=T_PLUS;
+			break;
+		case '-':
+			t=T_MINUS;
+			break;
+		case '*':
+			t=T_STAR;
+			break;
+		case '%':
+			t=T_PERCENT;
+			break;
+		case '/':
+			if(d=='/') {
+				while(i<n && src[i]!='\n') i++;
+				continue;
+			}
+			t=T_SLASH;
+			break;
+		case '!':
+			if(d=='=') {
+				t=T_NEQ;
+				w=2;
 			} else {
-				tv_push(out,(Token) {
-					.t=T_BANG
-				});
-				i++;
+				t=T_BANG;
 			}
-			continue;
-		}
-		if(c=='=') {
-			if(i+1<n && src[i+1]=='=') {
-				tv_push(out,(Token) {
-					.t=T_EQEQ
-				});
-				i+=2;
-			} else if(i+1<n && src[i+1]=='>') {
-				tv_push(out,(Token) {
-					.t=T_ARROW
-				});
-				i+=2;
+			break;
+		case '=':
+			if(d=='=') {
+				t=T_EQEQ;
+				w=2;
+			} else if(d=='>') {
+				t=T_ARROW;
+				w=2;
 			} else {
-				tv_push(out,(Token) {
-					.t=T_EQ
-				});
-				i++;
+				t=T_EQ;
 			}
-			continue;
-		}
-		if(c=='<') {
-			if(i+1<n && src[i+1]=='=') {
-				tv_push(out,(Token) {
-					.t=T_LEQ
-				});
-				i+=2;
+			break;
+		case '<':
+			if(d=='=') {
+				t=T_LEQ;
+				w=2;
 			} else {
-				tv_push(out,(Token) {
-					.t=T_LT
-				});
-				i++;
+				t=T_LT;
 			}
-			continue;
-		}
-		if(c=='>') {
-			if(i+1<n && src[i+1]=='=') {
-				tv_push(out,(Token) {
-					.t=T_GEQ
-				});
-				i+=2;
+			break;
+		case '>':
+			if(d=='=') {
+				t=T_GEQ;
+				w=2;
 			} else {
-				tv_push(out,(Token) {
-					.t=T_GT
-				});
-				i++;
+				t=T_GT;
 			}
-			continue;
-		}
-		if(c=='&' && i+1<n && src[i+1]=='&') {
-			tv_push(out,(Token) {
-				.t=T_ANDAND
-			});
-			i+=2;
-			continue;
-		}
-		if(c=='|' && i+1<n && src[i+1]=='|') {
-			tv_push(out,(Token) {
-				.t=T_OROR
-			});
-			i+=2;
-			continue;
-		}
-		if(c=='/' && i+1<n && src[i+1]=='/') {
-			i+=2;
-			while(i<n && src[i]!='\n') i++;
-			continue;
+			break;
+		case '.':
+			if(d!='.') dief("unexpected character '%c' in input", c);
+			t=T_DOTDOT;
+			w=2;
+			break;
+		case '&':
+			if(d!='&') dief("unexpected character '%c' in input", c);
+			t=T_ANDAND;
+			w=2;
+			break;
+		case '|':
+			if(d!='|') dief("unexpected character '%c' in input", c);
+			t=T_OROR;
+			w=2;
+			break;
+		default:
+			dief("unexpected character '%c' in input", c);
 		}
-		dief("unexpected character '%c' in input", c);
+		tv_push(out, (Token) {
+			.t=t, .off=(uint32_t)i
+		});
+		i+=w;
 	}
 	tv_push(out,(Token) {
-		.t=T_EOF
+		.t=T_EOF, .off=(uint32_t)n
 	});
 }
 
+static void tokenize(const char* src, TokVec* out) {
+	cclass_init();
+	tv_init(out);
+	out->src=src;
+	size_t n=strlen(src);
+	if(n>UINT32_MAX) die("source too large");
+	/* typical sources average well over eight bytes per token */
+	out->cap = n/8+64;
+	out->data = (Token*)malloc(out->cap*sizeof(Token));
+	if(!out->data) die("out of memory");
+	lex_into(src, n, out);
+}
+
 typedef struct AST AST;
 
 typedef enum {
@@ -336,10 +472,15 @@ typedef enum {
 	A_BLOCK,
 	A_IFELSE,
 	A_WHILE,
+	A_FOR,
 	A_FUNC_LIT,
 	A_CALL,
 	A_BUILTIN,
-	A_SEQ
+	A_INLINE,
+	A_PARAM_REF,
+	A_YIELD,
+	A_IMPORT,
+	A_NTAGS
 } ATag;
 
 typedef enum { U_NEG, U_NOT } UOp;
@@ -386,11 +527,6 @@ typedef struct {
 	AST* expr;
 } UnNode;
 
-typedef struct {
-	AST* left;
-	AST* right;
-} SeqNode;
-
 typedef struct {
 	AST** conds;
 	AST** bodies;
@@ -403,13 +539,41 @@ typedef struct {
 	AST* body;
 } WhileNode;
 
+typedef struct {
+	AST* id;
+	AST* from;
+	AST* to;
+	AST* body;
+} ForNode;
+
+typedef struct {
+	const char* name;
+	bool late;
+} Capture;
+
 typedef struct {
 	AST** params;
-	size_t nparams;
 	AST* body;
+	Capture* caps;
+	const char* name; /* of the var it is bound to, for profiles */
+	uint32_t nparams;
+	uint32_t ncaps;
+	bool noescape;
+	bool gen; /* the body yields */
 } FuncNode;
 
-typedef enum { BUILTIN_OUTN } Builtin;
+typedef enum {
+	BUILTIN_OUTN,
+	BUILTIN_NEXT,
+	BUILTIN_DONE,
+	BUILTIN_MAP, /* {k: v, ...}, args alternate keys and values */
+	BUILTIN_INDEX, /* m[k] */
+	BUILTIN_GET,
+	BUILTIN_SET, /* also m[k] = v */
+	BUILTIN_HAS,
+	BUILTIN_DELETE,
+	BUILTIN_SIZE
+} Builtin;
 
 typedef struct {
 	Builtin bi;
@@ -417,8 +581,38 @@ typedef struct {
 	size_t nargs;
 } BuiltinNode;
 
+typedef struct {
+	AST** stmts;
+	size_t n, cap;
+} BlockNode;
+
+typedef struct {
+	AST* body;
+	AST** args;
+	size_t nargs;
+	const char* name;
+} InlineNode;
+
+typedef struct {
+	size_t index;
+	const char* name;
+} ParamRefNode;
+
+typedef struct {
+	AST* expr;
+} YieldNode;
+
+typedef struct Module Module;
+
+typedef struct {
+	char* path; /* as written, relative to the importing file */
+	Module* mod;
+} ImportNode;
+
 struct AST {
-	ATag tag;
+	ATag tag : 8;
+	bool typed : 1; /* operand checks proven by type_pass */
+	unsigned line : 23; /* where the statement, call or function literal starts */
 	union {
 		IdNode id;
 		int num;
@@ -427,9 +621,9 @@ struct AST {
 		AssignNode asn;
 		BinNode bin;
 		UnNode un;
-		SeqNode seq;
 		IfNode iff;
 		WhileNode wh;
+		ForNode fr;
 		FuncNode fn;
 		struct {
 			AST* callee;
@@ -437,15 +631,128 @@ struct AST {
 			size_t nargs;
 		} call;
 		BuiltinNode builtin;
-		struct {
-			AST* expr;
-		} block;
+		BlockNode block;
+		InlineNode inl;
+		ParamRefNode pref;
+		YieldNode yld;
+		ImportNode imp;
 	};
 };
 
+/*
+ * A module is parsed once per process, when the first import of its
+ * canonical path is parsed, and its body runs in the global Env the
+ * first time an import of it is evaluated.
+ */
+struct Module {
+	char* path; /* canonical */
+	uint64_t hash; /* of the source text */
+	AST* body;
+	bool loading, evaluated;
+	unsigned shadowed; /* builtin names it defines at top level, see Parser */
+	int emit_id;
+	Module* next;
+};
+
+static Module* modules = NULL;
+static bool verbose = false;
+
+static double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e3 + ts.tv_nsec/1e6;
+}
+
+/*
+ * Runtime statistics. The evaluator's counters are plain increments in
+ * its instrumented variant, which --stats selects, and are reported as
+ * JSON on stderr at exit.
+ */
+typedef enum { K_ENV, K_ENTRY, K_CLOSURE, K_FRAME, K_AST, K_MAP, K_NKINDS } AllocKind;
+
+#define STAT_BUCKETS 8
+#define STAT_LINEAR 64
+
+static struct {
+	unsigned long long nodes[A_NTAGS];
+	unsigned long long calls;
+	unsigned long long depth, max_depth;
+	unsigned long long lookups, misses;
+	unsigned long long hops[STAT_LINEAR+1]; /* the last slot counts STAT_LINEAR and deeper */
+	unsigned long long cmps[STAT_LINEAR+1];
+	unsigned long long allocs[K_NKINDS];
+	unsigned long long bytes[K_NKINDS];
+} stats;
+
+static bool stats_enabled = false;
+
+static const char* atag_names[A_NTAGS] = {
+	[A_ID]="id", [A_NUM]="num", [A_BOOL]="bool", [A_LET]="let",
+	[A_ASSIGN]="assign", [A_BIN]="bin", [A_UN]="un", [A_BLOCK]="block",
+	[A_IFELSE]="ifelse", [A_WHILE]="while", [A_FOR]="for",
+	[A_FUNC_LIT]="func_lit", [A_CALL]="call", [A_BUILTIN]="builtin",
+	[A_INLINE]="inline", [A_PARAM_REF]="param_ref", [A_YIELD]="yield", [A_IMPORT]="import",
+};
+
+static const char* kind_names[K_NKINDS] = {
+	[K_ENV]="env", [K_ENTRY]="entry", [K_CLOSURE]="closure", [K_FRAME]="frame", [K_AST]="ast", [K_MAP]="map",
+};
+
+/* reported buckets: 0, 1, 2-3, 4-7, 8-15, 16-31, 32-63, 64+ */
+static unsigned stat_bucket(unsigned v) {
+	unsigned b=0;
+	while(v && b<STAT_BUCKETS-1) {
+		v>>=1;
+		b++;
+	}
+	return b;
+}
+
+#define STAT_ALLOC(kind, n) do { stats.allocs[kind]++; stats.bytes[kind]+=(n); } while(0)
+
+static void stats_histogram(const char* key, const unsigned long long* linear) {
+	unsigned long long h[STAT_BUCKETS]= {0};
+	for(unsigned v=0; v<=STAT_LINEAR; v++) h[stat_bucket(v)]+=linear[v];
+	fprintf(stderr, "  \"%s\": {", key);
+	for(unsigned b=0; b<STAT_BUCKETS; b++) {
+		unsigned lo = b? 1u<<(b-1) : 0, hi = b? (1u<<b)-1 : 0;
+		if(b==0) fprintf(stderr, "\"0\": %llu", h[b]);
+		else if(b==STAT_BUCKETS-1) fprintf(stderr, ", \"%u+\": %llu", lo, h[b]);
+		else if(lo==hi) fprintf(stderr, ", \"%u\": %llu", lo, h[b]);
+		else fprintf(stderr, ", \"%u-%u\": %llu", lo, hi, h[b]);
+	}
+	fprintf(stderr, "},\n");
+}
+
+static void stats_report(void) {
+	if(!stats_enabled) return;
+	fflush(stdout);
+	unsigned long long total=0;
+	for(int t=0; t<A_NTAGS; t++) total+=stats.nodes[t];
+	fprintf(stderr, "{\n  \"nodes\": {");
+	for(int t=0; t<A_NTAGS; t++) fprintf(stderr, "%s\"%s\": %llu", t? ", " : "", atag_names[t], stats.nodes[t]);
+	fprintf(stderr, "},\n  \"nodes_total\": %llu,\n", total);
+	fprintf(stderr, "  \"calls\": %llu,\n  \"max_depth\": %llu,\n", stats.calls, stats.max_depth);
+	fprintf(stderr, "  \"lookups\": %llu,\n  \"lookup_misses\": %llu,\n", stats.lookups, stats.misses);
+	stats_histogram("lookup_hops", stats.hops);
+	stats_histogram("lookup_strcmp", stats.cmps);
+	fprintf(stderr, "  \"alloc\": {");
+	for(int k=0; k<K_NKINDS; k++) {
+		fprintf(stderr, "%s\"%s\": {\"count\": %llu, \"bytes\": %llu}", k? ", " : "", kind_names[k], stats.allocs[k], stats.bytes[k]);
+	}
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	fprintf(stderr, "},\n  \"peak_rss_kb\": %ld\n}\n", (long)ru.ru_maxrss);
+}
+
+/* line of the token the parser consumed last */
+static uint32_t parse_line = 0;
+
 static AST* mk(AST a) {
+	STAT_ALLOC(K_AST, sizeof(AST));
 	AST* p=(AST*)malloc(sizeof(AST));
 	*p=a;
+	if(!p->line) p->line=parse_line;
 	return p;
 }
 static AST* mk_num(int v) {
@@ -458,18 +765,80 @@ static AST* mk_bool(bool b) {
 		.tag=A_BOOL, .boolean=b
 	});
 }
-static AST* mk_id(const char* s, bool c) {
+static AST* mk_id(const char* s, size_t len, bool c) {
 	AST* a=mk((AST) {
 		.tag=A_ID
 	});
-	a->id.name=strdup(s);
+	a->id.name=(char*)malloc(len+1);
+	memcpy(a->id.name, s, len);
+	a->id.name[len]='\0';
 	a->id.constant=c;
 	return a;
 }
 
+/*
+ * Escape analysis. Blocks do not open scopes, so the only thing that can
+ * retain a call environment past its return is a function literal
+ * evaluated inside the body. Bodies without one get their frame from the
+ * bump allocated frame stack instead of the heap.
+ */
+static bool has_func_lit(AST* a) {
+	if(!a) return false;
+	switch(a->tag) {
+	case A_ID:
+	case A_NUM:
+	case A_BOOL:
+		return false;
+	case A_FUNC_LIT:
+		return true;
+	case A_LET:
+		return has_func_lit(a->var_.expr);
+	case A_ASSIGN:
+		return has_func_lit(a->asn.expr);
+	case A_BIN:
+		return has_func_lit(a->bin.left) || has_func_lit(a->bin.right);
+	case A_UN:
+		return has_func_lit(a->un.expr);
+	case A_BLOCK:
+		for(size_t i=0; i<a->block.n; i++) if(has_func_lit(a->block.stmts[i])) return true;
+		return false;
+	case A_IFELSE:
+		for(size_t i=0; i<a->iff.n; i++) {
+			if(has_func_lit(a->iff.conds[i]) || has_func_lit(a->iff.bodies[i])) return true;
+		}
+		return has_func_lit(a->iff.elseBody);
+	case A_WHILE:
+		return has_func_lit(a->wh.cond) || has_func_lit(a->wh.body);
+	case A_FOR:
+		return has_func_lit(a->fr.from) || has_func_lit(a->fr.to) || has_func_lit(a->fr.body);
+	case A_CALL:
+		if(has_func_lit(a->call.callee)) return true;
+		for(size_t i=0; i<a->call.nargs; i++) if(has_func_lit(a->call.args[i])) return true;
+		return false;
+	case A_BUILTIN:
+		for(size_t i=0; i<a->builtin.nargs; i++) if(has_func_lit(a->builtin.args[i])) return true;
+		return false;
+	case A_INLINE:
+		for(size_t i=0; i<a->inl.nargs; i++) if(has_func_lit(a->inl.args[i])) return true;
+		return has_func_lit(a->inl.body);
+	case A_PARAM_REF:
+		return false;
+	case A_YIELD:
+		return has_func_lit(a->yld.expr);
+	default:
+		return true;
+	}
+}
+
 typedef struct {
 	TokVec* toks;
 	size_t i;
+	int fn_depth;
+	bool yields; /* the innermost function literal contains a yield */
+	const char* dir; /* imports resolve against it, NULL for the working directory */
+	AST** imports;
+	size_t nimports;
+	unsigned shadowed; /* bit i: the program binds builtin_names[i] itself */
 } Parser;
 
 static Token* P_peek(Parser* p) {
@@ -482,19 +851,20 @@ static bool P_check(Parser* p, Tok t) {
 
 static bool P_is(Parser* p, Tok t) {
 	if(P_check(p,t)) {
-		p->i++;
+		parse_line=tv_line(p->toks, &p->toks->data[p->i++]);
 		return true;
 	}
 	return false;
 }
 
 static Token* P_adv(Parser* p) {
+	parse_line=tv_line(p->toks, &p->toks->data[p->i]);
 	return &p->toks->data[p->i++];
 }
 
 static void P_consume(Parser* p, Tok t, const char* msg) {
 	if(!P_check(p,t)) dief("parse error: %s", msg);
-	p->i++;
+	parse_line=tv_line(p->toks, &p->toks->data[p->i++]);
 }
 
 static AST* parse_expr(Parser* p); static AST* parse_stmt(Parser* p); static AST* parse_block(Parser* p);
@@ -556,33 +926,83 @@ static BOp tok_to_binop(Tok t) {
 		die("internal: unknown binop token");
 	}
 }
-static AST* parse_primary(Parser* p) {
+static AST* mk_builtin(Builtin bi, AST** args, size_t n) {
+	AST a= {.tag=A_BUILTIN};
+	a.builtin.bi=bi;
+	a.builtin.args=args;
+	a.builtin.nargs=n;
+	return mk(a);
+}
+
+/*
+ * Builtins called by name. The name is only taken when a '(' follows and
+ * the program does not bind it: a top-level var/const in the same source,
+ * a global that already exists, a name a module defines at top level, or
+ * a parameter, local or for variable of an enclosing function shadows it,
+ * and the call goes to the user's function as it always did.
+ */
+typedef struct {
+	const char* name;
+	Builtin bi;
+	size_t nargs;
+} BuiltinName;
+
+static const BuiltinName builtin_names[] = {
+	{"next", BUILTIN_NEXT, 1}, {"done", BUILTIN_DONE, 1}, {"get", BUILTIN_GET, 2}, {"set", BUILTIN_SET, 3},
+	{"has", BUILTIN_HAS, 2}, {"delete", BUILTIN_DELETE, 2}, {"size", BUILTIN_SIZE, 1},
+};
+
+static const BuiltinName* builtin_name(const char* s, size_t len) {
+	for(size_t i=0; i<sizeof(builtin_names)/sizeof(builtin_names[0]); i++) {
+		if(strlen(builtin_names[i].name)==len && memcmp(builtin_names[i].name, s, len)==0) return &builtin_names[i];
+	}
+	return NULL;
+}
+
+static unsigned builtin_bit(const char* s, size_t len) {
+	const BuiltinName* bn=builtin_name(s, len);
+	return bn? 1u<<(bn-builtin_names) : 0;
+}
+
+static AST* parse_atom(Parser* p) {
 	if(P_is(p,T_LP)) {
 		AST* e=parse_expr(p);
 		P_consume(p,T_RP, "expected ')'");
 		return e;
 	}
 	if(P_is(p,T_FUNC)) {
+		uint32_t line=parse_line;
 		P_consume(p, T_LP, "expected '(' after func");
 		AST** params=NULL;
 		size_t np=0;
+		unsigned outer_shadowed=p->shadowed;
 		if(!P_check(p, T_RP)) {
 			do {
 				if(!P_check(p, T_ID)) die("expected parameter identifier");
 				Token* tk=P_adv(p);
+				p->shadowed|=builtin_bit(p->toks->src+tk->off, tk->len);
 				params = (AST**)realloc(params, (np+1)*sizeof(AST*));
-				params[np++] = mk_id(tk->sval,false);
+				params[np++] = mk_id(p->toks->src+tk->off,tk->len,false);
 			} while(P_is(p, T_COMMA));
 		}
 		P_consume(p,T_RP,"expected ')'");
 		P_consume(p,T_ARROW,"expected '=>'");
+		bool outer_yields=p->yields;
+		p->yields=false;
+		p->fn_depth++;
 		AST* body=NULL;
 		if(P_check(p,T_LBRACE)) body=parse_block(p);
 		else body=parse_expr(p);
-		AST a= {.tag=A_FUNC_LIT};
+		p->fn_depth--;
+		p->shadowed=outer_shadowed;
+		AST a= {.tag=A_FUNC_LIT, .line=line};
 		a.fn.params=params;
 		a.fn.nparams=np;
 		a.fn.body=body;
+		a.fn.gen=p->yields;
+		/* a generator's Env outlives the call that creates it */
+		a.fn.noescape=!a.fn.gen && !has_func_lit(body);
+		p->yields=outer_yields;
 		return mk(a);
 	}
 	if(P_check(p,T_NUM)) {
@@ -590,12 +1010,47 @@ static AST* parse_primary(Parser* p) {
 		return mk_num(v);
 	}
 	if(P_check(p,T_BOOL)) {
-		bool b=strcmp(P_adv(p)->sval,"true")==0;
+		bool b=P_adv(p)->ival!=0;
 		return mk_bool(b);
 	}
+	if(P_is(p,T_YIELD)) {
+		if(!p->fn_depth) die("parse error: yield outside function");
+		AST* e=parse_expr(p);
+		p->yields=true;
+		return mk((AST) {
+			.tag=A_YIELD, .yld= {.expr=e}
+		});
+	}
+	if(P_is(p,T_LBRACE)) {
+		AST** args=NULL;
+		size_t na=0;
+		if(!P_check(p,T_RBRACE)) {
+			do {
+				args=(AST**)realloc(args,(na+2)*sizeof(AST*));
+				args[na++]=parse_expr(p);
+				P_consume(p,T_COLON,"expected ':' in map literal");
+				args[na++]=parse_expr(p);
+			} while(P_is(p,T_COMMA));
+		}
+		P_consume(p,T_RBRACE,"expected '}' after map literal");
+		return mk_builtin(BUILTIN_MAP, args, na);
+	}
 	if(P_check(p,T_ID)) {
 		Token* id=P_adv(p);
-		AST* base = mk_id(id->sval,false);
+		const char* name=p->toks->src+id->off;
+		const BuiltinName* bn=builtin_name(name, id->len);
+		if(bn && !(p->shadowed & 1u<<(bn-builtin_names)) && P_check(p,T_LP)) {
+			P_adv(p);
+			AST** args=(AST**)malloc(bn->nargs*sizeof(AST*));
+			for(size_t i=0; i<bn->nargs; i++) {
+				if(i) P_consume(p,T_COMMA,"expected ','");
+				args[i]=parse_expr(p);
+			}
+			if(!P_check(p,T_RP)) dief("parse error: %s expects %zu argument%s", bn->name, bn->nargs, bn->nargs>1? "s" : "");
+			P_adv(p);
+			return mk_builtin(bn->bi, args, bn->nargs);
+		}
+		AST* base = mk_id(name,id->len,false);
 		if(P_check(p,T_LP)) {
 			P_adv(p);
 			AST** args=NULL;
@@ -608,7 +1063,7 @@ static AST* parse_primary(Parser* p) {
 				} while(P_is(p,T_COMMA));
 			}
 			P_consume(p,T_RP,"expected ')'");
-			AST a= {.tag=A_CALL};
+			AST a= {.tag=A_CALL, .line=tv_line(p->toks, id)};
 			a.call.callee = base;
 			a.call.args=args;
 			a.call.nargs=na;
@@ -620,17 +1075,26 @@ static AST* parse_primary(Parser* p) {
 		P_consume(p,T_LP,"expected '(' after outn");
 		AST* arg=parse_expr(p);
 		P_consume(p,T_RP,"expected ')'");
-		AST a= {.tag=A_BUILTIN};
-		a.builtin.bi=BUILTIN_OUTN;
-		a.builtin.args=(AST**)malloc(sizeof(AST*));
-		a.builtin.args[0]=arg;
-		a.builtin.nargs=1;
-		return mk(a);
+		AST** args=(AST**)malloc(sizeof(AST*));
+		args[0]=arg;
+		return mk_builtin(BUILTIN_OUTN, args, 1);
 	}
 	die("unexpected token in primary");
 	return NULL;
 }
 
+static AST* parse_primary(Parser* p) {
+	AST* e=parse_atom(p);
+	while(P_is(p,T_LBRACKET)) {
+		AST** args=(AST**)malloc(2*sizeof(AST*));
+		args[0]=e;
+		args[1]=parse_expr(p);
+		P_consume(p,T_RBRACKET,"expected ']'");
+		e=mk_builtin(BUILTIN_INDEX, args, 2);
+	}
+	return e;
+}
+
 static AST* parse_unary(Parser* p) {
 	if(P_is(p,T_BANG)) {
 		AST* e=parse_unary(p);
@@ -717,18 +1181,40 @@ static AST* parse_while(Parser* p) {
 	return mk(a);
 }
 
-static AST* parse_stmt(Parser* p) {
+static AST* parse_for(Parser* p) {
+	if(!P_check(p,T_ID)) die("expected identifier after for");
+	Token* id=P_adv(p);
+	p->shadowed|=builtin_bit(p->toks->src+id->off, id->len);
+	P_consume(p,T_IN,"expected 'in' after for variable");
+	AST* from=parse_expr(p);
+	P_consume(p,T_DOTDOT,"expected '..' in for range");
+	AST* to=parse_expr(p);
+	AST* body=parse_block(p);
+	AST a= {.tag=A_FOR};
+	a.fr.id=mk_id(p->toks->src+id->off,id->len,false);
+	a.fr.from=from;
+	a.fr.to=to;
+	a.fr.body=body;
+	return mk(a);
+}
+
+static Module* module_import(const char* dir, const char* path);
+
+static AST* parse_statement(Parser* p) {
 	if(P_is(p,T_LET) || P_is(p,T_CONST)) {
 		bool isConst = p->toks->data[p->i-1].t==T_CONST;
 		if(!P_check(p,T_ID)) die("expected identifier after var/const");
 		Token* id=P_adv(p);
+		/* restored with the parameters when the enclosing function ends */
+		if(p->fn_depth) p->shadowed|=builtin_bit(p->toks->src+id->off, id->len);
 		P_consume(p,T_EQ,"expected '=' after identifier");
 		AST* expr=parse_expr(p);
 		P_consume(p,T_SEMI,"expected ';' after declaration");
 		AST a= {.tag=A_LET};
-		a.var_.id = mk_id(id->sval,isConst);
+		a.var_.id = mk_id(p->toks->src+id->off,id->len,isConst);
 		a.var_.expr = expr;
 		a.var_.constant = isConst;
+		if(expr->tag==A_FUNC_LIT && !expr->fn.name) expr->fn.name=a.var_.id->id.name;
 		return mk(a);
 	}
 	if(P_check(p,T_ID) && p->toks->data[p->i+1].t==T_EQ) {
@@ -737,63 +1223,1182 @@ static AST* parse_stmt(Parser* p) {
 		AST* expr=parse_expr(p);
 		P_consume(p,T_SEMI,"expected ';' after assignment");
 		AST a= {.tag=A_ASSIGN};
-		a.asn.id = mk_id(id->sval,false);
+		a.asn.id = mk_id(p->toks->src+id->off,id->len,false);
 		a.asn.expr = expr;
+		if(expr->tag==A_FUNC_LIT && !expr->fn.name) expr->fn.name=a.asn.id->id.name;
 		return mk(a);
 	}
+	if(P_is(p,T_IMPORT)) {
+		if(p->fn_depth) die("parse error: import inside function");
+		if(!P_check(p,T_STR)) die("expected module path after import");
+		Token* t=P_adv(p);
+		P_consume(p,T_SEMI,"expected ';' after import");
+		AST a= {.tag=A_IMPORT};
+		a.imp.path=(char*)malloc(t->len+1);
+		memcpy(a.imp.path, p->toks->src+t->off, t->len);
+		a.imp.path[t->len]='\0';
+		a.imp.mod=module_import(p->dir, a.imp.path);
+		p->shadowed|=a.imp.mod->shadowed;
+		AST* n=mk(a);
+		p->imports=(AST**)realloc(p->imports, (p->nimports+1)*sizeof(AST*));
+		p->imports[p->nimports++]=n;
+		return n;
+	}
 	if(P_is(p,T_IF)) return parse_if(p);
 	if(P_is(p,T_WHILE)) return parse_while(p);
+	if(P_is(p,T_FOR)) return parse_for(p);
 	if(P_is(p,T_LBRACE)) {
 		p->i--;
 		return parse_block(p);
 	}
 	AST* e=parse_expr(p);
+	if(e->tag==A_BUILTIN && e->builtin.bi==BUILTIN_INDEX && P_is(p,T_EQ)) {
+		e->builtin.args=(AST**)realloc(e->builtin.args, 3*sizeof(AST*));
+		e->builtin.args[2]=parse_expr(p);
+		e->builtin.bi=BUILTIN_SET;
+		e->builtin.nargs=3;
+		P_consume(p,T_SEMI,"expected ';' after assignment");
+		return e;
+	}
 	P_consume(p,T_SEMI,"expected ';' after expression");
 	return e;
 }
 
-static AST* chain_seq(AST* left, AST* right) {
-	if(!left) return right;
-	if(!right) return left;
-	AST a= {.tag=A_SEQ};
-	a.seq.left=left;
-	a.seq.right=right;
-	return mk(a);
+/* a statement's line is where it starts, not where its last token is */
+static AST* parse_stmt(Parser* p) {
+	uint32_t line=tv_line(p->toks, P_peek(p));
+	AST* a=parse_statement(p);
+	a->line=line;
+	return a;
 }
 
-static AST* parse_block(Parser* p) {
+static void block_push(BlockNode* b, AST* s) {
+	if(b->n==b->cap) {
+		b->cap = b->cap? b->cap*2 : 8;
+		b->stmts = (AST**)realloc(b->stmts, b->cap*sizeof(AST*));
+	}
+	b->stmts[b->n++] = s;
+}
+
+static AST* parse_block(Parser* p) {
 	P_consume(p,T_LBRACE,"expected '{'");
-	AST* seq=NULL;
+	AST a= {.tag=A_BLOCK};
 	while(!P_check(p,T_RBRACE) && !P_check(p,T_EOF)) {
-		AST* s=parse_stmt(p);
-		seq = chain_seq(seq, s);
+		block_push(&a.block, parse_stmt(p));
 	}
 	P_consume(p,T_RBRACE,"expected '}'");
-	AST a= {.tag=A_BLOCK};
-	a.block.expr=seq;
 	return mk(a);
 }
 
 static AST* parse_program(Parser* p) {
 	if(P_check(p,T_LBRACE)) return parse_block(p);
-	AST* seq=NULL;
+	AST a= {.tag=A_BLOCK};
 	while(!P_check(p,T_EOF)) {
-		AST* s=parse_stmt(p);
-		seq = chain_seq(seq, s);
+		block_push(&a.block, parse_stmt(p));
 	}
-	AST a= {.tag=A_BLOCK};
-	a.block.expr=seq;
 	return mk(a);
 }
 
+/*
+ * Name table shared by the whole program analyses. Every binding site of
+ * a name (var/const, for, parameter) and every assignment is counted, so
+ * a pass can tell whether a name is only ever bound at top level or never
+ * reassigned, and reads other than as a direct callee are counted so it
+ * can tell whether a function value ever escapes its name. Lookup
+ * semantics are purely name based, which makes these counts a sound
+ * summary of what any Entry with that name can hold.
+ */
+typedef struct {
+	const char* name;
+	unsigned binds, top_binds, assigns, reads;
+	unsigned ty, ret;
+	AST* fn;
+	AST* inl_body;
+	size_t sites;
+	int sym; /* --emit-c's number for the name's static string, 0 until emitted */
+} NameInfo;
+
+typedef struct {
+	NameInfo* slots;
+	size_t cap, n;
+} NameTable;
+
+static uint64_t name_hash(const char* s) {
+	uint64_t h=1469598103934665603ull;
+	for(; *s; s++) {
+		h^=(unsigned char)*s;
+		h*=1099511628211ull;
+	}
+	return h;
+}
+
+static NameInfo* names_get(NameTable* t, const char* name) {
+	if((t->n+1)*2>t->cap) {
+		NameTable g= {.cap=t->cap? t->cap*2 : 64};
+		g.slots=(NameInfo*)calloc(g.cap, sizeof(NameInfo));
+		for(size_t i=0; i<t->cap; i++) {
+			if(!t->slots[i].name) continue;
+			size_t j=name_hash(t->slots[i].name)&(g.cap-1);
+			while(g.slots[j].name) j=(j+1)&(g.cap-1);
+			g.slots[j]=t->slots[i];
+		}
+		g.n=t->n;
+		free(t->slots);
+		*t=g;
+	}
+	size_t j=name_hash(name)&(t->cap-1);
+	while(t->slots[j].name) {
+		if(strcmp(t->slots[j].name, name)==0) return &t->slots[j];
+		j=(j+1)&(t->cap-1);
+	}
+	t->slots[j].name=name;
+	t->n++;
+	return &t->slots[j];
+}
+
+static void names_free(NameTable* t) {
+	free(t->slots);
+}
+
+/*
+ * Names mentioned by a prelude restored from an image. Its code is not
+ * part of the program the passes see but can bind, write, read and call
+ * any of them, so each is counted as bound at top level and assigned.
+ */
+static const char** image_names = NULL;
+static size_t image_nnames = 0;
+
+static void names_seed(NameTable* t) {
+	for(size_t i=0; i<image_nnames; i++) {
+		NameInfo* ni=names_get(t, image_names[i]);
+		ni->binds++;
+		ni->top_binds++;
+		ni->assigns++;
+		ni->reads++;
+	}
+}
+
+static void names_scan(AST* a, NameTable* t, bool top) {
+	if(!a) return;
+	switch(a->tag) {
+	case A_LET: {
+		NameInfo* ni=names_get(t, a->var_.id->id.name);
+		ni->binds++;
+		if(top) ni->top_binds++;
+		names_scan(a->var_.expr, t, top);
+		break;
+	}
+	case A_ASSIGN:
+		names_get(t, a->asn.id->id.name)->assigns++;
+		names_scan(a->asn.expr, t, top);
+		break;
+	case A_FOR: {
+		NameInfo* ni=names_get(t, a->fr.id->id.name);
+		ni->binds++;
+		if(top) ni->top_binds++;
+		names_scan(a->fr.from, t, top);
+		names_scan(a->fr.to, t, top);
+		names_scan(a->fr.body, t, top);
+		break;
+	}
+	case A_FUNC_LIT:
+		for(size_t i=0; i<a->fn.nparams; i++) names_get(t, a->fn.params[i]->id.name)->binds++;
+		names_scan(a->fn.body, t, false);
+		break;
+	case A_ID:
+		names_get(t, a->id.name)->reads++;
+		break;
+	case A_BIN:
+		names_scan(a->bin.left, t, top);
+		names_scan(a->bin.right, t, top);
+		break;
+	case A_UN:
+		names_scan(a->un.expr, t, top);
+		break;
+	case A_BLOCK:
+		for(size_t i=0; i<a->block.n; i++) names_scan(a->block.stmts[i], t, top);
+		break;
+	case A_IFELSE:
+		for(size_t i=0; i<a->iff.n; i++) {
+			names_scan(a->iff.conds[i], t, top);
+			names_scan(a->iff.bodies[i], t, top);
+		}
+		names_scan(a->iff.elseBody, t, top);
+		break;
+	case A_WHILE:
+		names_scan(a->wh.cond, t, top);
+		names_scan(a->wh.body, t, top);
+		break;
+	case A_CALL:
+		if(a->call.callee->tag==A_ID) names_get(t, a->call.callee->id.name);
+		else names_scan(a->call.callee, t, top);
+		for(size_t i=0; i<a->call.nargs; i++) names_scan(a->call.args[i], t, top);
+		break;
+	case A_BUILTIN:
+		for(size_t i=0; i<a->builtin.nargs; i++) names_scan(a->builtin.args[i], t, top);
+		break;
+	case A_INLINE:
+		for(size_t i=0; i<a->inl.nargs; i++) names_scan(a->inl.args[i], t, top);
+		break;
+	case A_YIELD:
+		names_scan(a->yld.expr, t, top);
+		break;
+	case A_IMPORT:
+		names_scan(a->imp.mod->body, t, top);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Capture analysis for flat closures. Every name a function literal
+ * mentions, its own parameters and locals included, is listed on the
+ * literal: env_define binds into an outer binding when one exists, so a
+ * parameter or var can land in a captured variable just like a read.
+ * A name is late when an enclosing function binds it as a parameter or
+ * in its own body; such a name may not exist yet when the closure is
+ * created but still appear in the defining Env later, which a flat
+ * closure would miss.
+ */
+/* names a call Env of a function can gain: its parameters and the vars and loops of its own body */
+static void capture_binds(AST* a, NameTable* t) {
+	if(!a) return;
+	switch(a->tag) {
+	case A_LET:
+		names_get(t, a->var_.id->id.name)->binds++;
+		capture_binds(a->var_.expr, t);
+		break;
+	case A_FOR:
+		names_get(t, a->fr.id->id.name)->binds++;
+		capture_binds(a->fr.from, t);
+		capture_binds(a->fr.to, t);
+		capture_binds(a->fr.body, t);
+		break;
+	case A_ASSIGN:
+		capture_binds(a->asn.expr, t);
+		break;
+	case A_BIN:
+		capture_binds(a->bin.left, t);
+		capture_binds(a->bin.right, t);
+		break;
+	case A_UN:
+		capture_binds(a->un.expr, t);
+		break;
+	case A_BLOCK:
+		for(size_t i=0; i<a->block.n; i++) capture_binds(a->block.stmts[i], t);
+		break;
+	case A_IFELSE:
+		for(size_t i=0; i<a->iff.n; i++) {
+			capture_binds(a->iff.conds[i], t);
+			capture_binds(a->iff.bodies[i], t);
+		}
+		capture_binds(a->iff.elseBody, t);
+		break;
+	case A_WHILE:
+		capture_binds(a->wh.cond, t);
+		capture_binds(a->wh.body, t);
+		break;
+	case A_CALL:
+		capture_binds(a->call.callee, t);
+		for(size_t i=0; i<a->call.nargs; i++) capture_binds(a->call.args[i], t);
+		break;
+	case A_BUILTIN:
+		for(size_t i=0; i<a->builtin.nargs; i++) capture_binds(a->builtin.args[i], t);
+		break;
+	case A_YIELD:
+		capture_binds(a->yld.expr, t);
+		break;
+	default:
+		break;
+	}
+}
+
+static void capture_pass(AST* a, NameTable* outer) {
+	if(!a) return;
+	switch(a->tag) {
+	case A_FUNC_LIT: {
+		NameTable t= {0};
+		names_scan(a, &t, false);
+		a->fn.caps=(Capture*)malloc((t.n? t.n : 1)*sizeof(Capture));
+		a->fn.ncaps=0;
+		for(size_t i=0; i<t.cap; i++) {
+			const char* name=t.slots[i].name;
+			if(!name) continue;
+			Capture* c=&a->fn.caps[a->fn.ncaps++];
+			c->name=name;
+			c->late = outer && names_get(outer, name)->binds;
+		}
+		NameTable inner= {0};
+		for(size_t i=0; outer && i<outer->cap; i++) {
+			if(outer->slots[i].name && outer->slots[i].binds) names_get(&inner, outer->slots[i].name)->binds++;
+		}
+		for(size_t i=0; i<a->fn.nparams; i++) names_get(&inner, a->fn.params[i]->id.name)->binds++;
+		capture_binds(a->fn.body, &inner);
+		capture_pass(a->fn.body, &inner);
+		names_free(&inner);
+		names_free(&t);
+		break;
+	}
+	case A_LET:
+		capture_pass(a->var_.expr, outer);
+		break;
+	case A_ASSIGN:
+		capture_pass(a->asn.expr, outer);
+		break;
+	case A_BIN:
+		capture_pass(a->bin.left, outer);
+		capture_pass(a->bin.right, outer);
+		break;
+	case A_UN:
+		capture_pass(a->un.expr, outer);
+		break;
+	case A_BLOCK:
+		for(size_t i=0; i<a->block.n; i++) capture_pass(a->block.stmts[i], outer);
+		break;
+	case A_IFELSE:
+		for(size_t i=0; i<a->iff.n; i++) {
+			capture_pass(a->iff.conds[i], outer);
+			capture_pass(a->iff.bodies[i], outer);
+		}
+		capture_pass(a->iff.elseBody, outer);
+		break;
+	case A_WHILE:
+		capture_pass(a->wh.cond, outer);
+		capture_pass(a->wh.body, outer);
+		break;
+	case A_FOR:
+		capture_pass(a->fr.from, outer);
+		capture_pass(a->fr.to, outer);
+		capture_pass(a->fr.body, outer);
+		break;
+	case A_CALL:
+		capture_pass(a->call.callee, outer);
+		for(size_t i=0; i<a->call.nargs; i++) capture_pass(a->call.args[i], outer);
+		break;
+	case A_BUILTIN:
+		for(size_t i=0; i<a->builtin.nargs; i++) capture_pass(a->builtin.args[i], outer);
+		break;
+	case A_YIELD:
+		capture_pass(a->yld.expr, outer);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Inlining of small helpers. A call site X(args) becomes an A_INLINE node
+ * when X is bound exactly once, by a top level var/const statement that
+ * precedes the site, to a function literal whose body is a small
+ * expression with no bindings, assignments, loops or nested functions.
+ * Arguments are still evaluated once, left to right, before the body; the
+ * body reads them through A_PARAM_REF slots instead of a fresh Env.
+ * Parameter names must never be bound at top level, since a real call
+ * would write such a parameter into the global binding, and the body's
+ * other free names must only ever be bound at top level, so that they
+ * resolve to the same global from any call site.
+ */
+#define INLINE_MAX_NODES 24
+#define INLINE_MAX_PARAMS 8
+
+static size_t inline_size(AST* a, const char* self) {
+	if(!a) return 0;
+	switch(a->tag) {
+	case A_NUM:
+	case A_BOOL:
+		return 1;
+	case A_ID:
+		/* a reference to itself means recursion */
+		return strcmp(a->id.name, self)==0? INLINE_MAX_NODES+1 : 1;
+	case A_BIN:
+		return 1+inline_size(a->bin.left, self)+inline_size(a->bin.right, self);
+	case A_UN:
+		return 1+inline_size(a->un.expr, self);
+	case A_BLOCK: {
+		size_t n=1;
+		for(size_t i=0; i<a->block.n; i++) n+=inline_size(a->block.stmts[i], self);
+		return n;
+	}
+	case A_IFELSE: {
+		size_t n=1;
+		for(size_t i=0; i<a->iff.n; i++) n+=inline_size(a->iff.conds[i], self)+inline_size(a->iff.bodies[i], self);
+		return n+inline_size(a->iff.elseBody, self);
+	}
+	case A_CALL: {
+		size_t n=1+inline_size(a->call.callee, self);
+		for(size_t i=0; i<a->call.nargs; i++) n+=inline_size(a->call.args[i], self);
+		return n;
+	}
+	case A_BUILTIN: {
+		size_t n=1;
+		for(size_t i=0; i<a->builtin.nargs; i++) n+=inline_size(a->builtin.args[i], self);
+		return n;
+	}
+	case A_INLINE: {
+		size_t n=1;
+		for(size_t i=0; i<a->inl.nargs; i++) n+=inline_size(a->inl.args[i], self);
+		return n;
+	}
+	default:
+		return INLINE_MAX_NODES+1;
+	}
+}
+
+static AST* inline_clone(AST* a, AST* fn) {
+	if(!a) return NULL;
+	AST c=*a;
+	switch(a->tag) {
+	case A_ID:
+		for(size_t i=0; i<fn->fn.nparams; i++) {
+			if(strcmp(fn->fn.params[i]->id.name, a->id.name)==0) {
+				c.tag=A_PARAM_REF;
+				c.pref.index=i;
+				c.pref.name=a->id.name;
+				break;
+			}
+		}
+		break;
+	case A_BIN:
+		c.bin.left=inline_clone(a->bin.left, fn);
+		c.bin.right=inline_clone(a->bin.right, fn);
+		break;
+	case A_UN:
+		c.un.expr=inline_clone(a->un.expr, fn);
+		break;
+	case A_BLOCK:
+		c.block.stmts=(AST**)malloc((a->block.n? a->block.n : 1)*sizeof(AST*));
+		c.block.cap=a->block.n;
+		for(size_t i=0; i<a->block.n; i++) c.block.stmts[i]=inline_clone(a->block.stmts[i], fn);
+		break;
+	case A_IFELSE:
+		c.iff.conds=(AST**)malloc(a->iff.n*sizeof(AST*));
+		c.iff.bodies=(AST**)malloc(a->iff.n*sizeof(AST*));
+		for(size_t i=0; i<a->iff.n; i++) {
+			c.iff.conds[i]=inline_clone(a->iff.conds[i], fn);
+			c.iff.bodies[i]=inline_clone(a->iff.bodies[i], fn);
+		}
+		c.iff.elseBody=inline_clone(a->iff.elseBody, fn);
+		break;
+	case A_CALL:
+		c.call.callee=inline_clone(a->call.callee, fn);
+		c.call.args=(AST**)malloc((a->call.nargs? a->call.nargs : 1)*sizeof(AST*));
+		for(size_t i=0; i<a->call.nargs; i++) c.call.args[i]=inline_clone(a->call.args[i], fn);
+		break;
+	case A_BUILTIN:
+		c.builtin.args=(AST**)malloc((a->builtin.nargs? a->builtin.nargs : 1)*sizeof(AST*));
+		for(size_t i=0; i<a->builtin.nargs; i++) c.builtin.args[i]=inline_clone(a->builtin.args[i], fn);
+		break;
+	case A_INLINE:
+		/* the callee's body only reads its own slots and is shared */
+		c.inl.args=(AST**)malloc((a->inl.nargs? a->inl.nargs : 1)*sizeof(AST*));
+		for(size_t i=0; i<a->inl.nargs; i++) c.inl.args[i]=inline_clone(a->inl.args[i], fn);
+		break;
+	default:
+		break;
+	}
+	return mk(c);
+}
+
+static bool inline_free_ok(AST* a, AST* fn, NameTable* t) {
+	if(!a) return true;
+	switch(a->tag) {
+	case A_ID: {
+		for(size_t i=0; i<fn->fn.nparams; i++) if(strcmp(fn->fn.params[i]->id.name, a->id.name)==0) return true;
+		NameInfo* ni=names_get(t, a->id.name);
+		return ni->binds==ni->top_binds;
+	}
+	case A_BIN:
+		return inline_free_ok(a->bin.left, fn, t) && inline_free_ok(a->bin.right, fn, t);
+	case A_UN:
+		return inline_free_ok(a->un.expr, fn, t);
+	case A_BLOCK:
+		for(size_t i=0; i<a->block.n; i++) if(!inline_free_ok(a->block.stmts[i], fn, t)) return false;
+		return true;
+	case A_IFELSE:
+		for(size_t i=0; i<a->iff.n; i++) {
+			if(!inline_free_ok(a->iff.conds[i], fn, t) || !inline_free_ok(a->iff.bodies[i], fn, t)) return false;
+		}
+		return inline_free_ok(a->iff.elseBody, fn, t);
+	case A_CALL:
+		if(!inline_free_ok(a->call.callee, fn, t)) return false;
+		for(size_t i=0; i<a->call.nargs; i++) if(!inline_free_ok(a->call.args[i], fn, t)) return false;
+		return true;
+	case A_BUILTIN:
+		for(size_t i=0; i<a->builtin.nargs; i++) if(!inline_free_ok(a->builtin.args[i], fn, t)) return false;
+		return true;
+	case A_INLINE:
+		for(size_t i=0; i<a->inl.nargs; i++) if(!inline_free_ok(a->inl.args[i], fn, t)) return false;
+		return true;
+	default:
+		return true;
+	}
+}
+
+static void inline_candidate(AST* stmt, NameTable* t) {
+	if(stmt->tag!=A_LET || stmt->var_.expr->tag!=A_FUNC_LIT) return;
+	const char* name=stmt->var_.id->id.name;
+	NameInfo* ni=names_get(t, name);
+	if(ni->binds!=1 || ni->assigns!=0) return;
+	AST* fn=stmt->var_.expr;
+	if(fn->fn.nparams>INLINE_MAX_PARAMS) return;
+	for(size_t i=0; i<fn->fn.nparams; i++) {
+		const char* p=fn->fn.params[i]->id.name;
+		if(names_get(t, p)->top_binds) return;
+		for(size_t j=0; j<i; j++) if(strcmp(fn->fn.params[j]->id.name, p)==0) return;
+	}
+	AST* body=fn->fn.body;
+	if(body->tag==A_BLOCK) {
+		if(body->block.n!=1) return;
+		body=body->block.stmts[0];
+	}
+	if(inline_size(body, name)>INLINE_MAX_NODES) return;
+	if(!inline_free_ok(body, fn, t)) return;
+	ni=names_get(t, name);
+	ni->fn=fn;
+	ni->inl_body=inline_clone(body, fn);
+}
+
+static void inline_walk(AST* a, NameTable* t) {
+	if(!a) return;
+	switch(a->tag) {
+	case A_LET:
+		inline_walk(a->var_.expr, t);
+		break;
+	case A_ASSIGN:
+		inline_walk(a->asn.expr, t);
+		break;
+	case A_BIN:
+		inline_walk(a->bin.left, t);
+		inline_walk(a->bin.right, t);
+		break;
+	case A_UN:
+		inline_walk(a->un.expr, t);
+		break;
+	case A_BLOCK:
+		for(size_t i=0; i<a->block.n; i++) inline_walk(a->block.stmts[i], t);
+		break;
+	case A_IFELSE:
+		for(size_t i=0; i<a->iff.n; i++) {
+			inline_walk(a->iff.conds[i], t);
+			inline_walk(a->iff.bodies[i], t);
+		}
+		inline_walk(a->iff.elseBody, t);
+		break;
+	case A_WHILE:
+		inline_walk(a->wh.cond, t);
+		inline_walk(a->wh.body, t);
+		break;
+	case A_FOR:
+		inline_walk(a->fr.from, t);
+		inline_walk(a->fr.to, t);
+		inline_walk(a->fr.body, t);
+		break;
+	case A_FUNC_LIT:
+		inline_walk(a->fn.body, t);
+		break;
+	case A_BUILTIN:
+		for(size_t i=0; i<a->builtin.nargs; i++) inline_walk(a->builtin.args[i], t);
+		break;
+	case A_CALL: {
+		inline_walk(a->call.callee, t);
+		for(size_t i=0; i<a->call.nargs; i++) inline_walk(a->call.args[i], t);
+		if(a->call.callee->tag!=A_ID) break;
+		NameInfo* ni=names_get(t, a->call.callee->id.name);
+		if(!ni->inl_body || ni->fn->fn.nparams!=a->call.nargs) break;
+		AST** args=a->call.args;
+		size_t nargs=a->call.nargs;
+		a->tag=A_INLINE;
+		a->inl.body=ni->inl_body;
+		a->inl.args=args;
+		a->inl.nargs=nargs;
+		a->inl.name=ni->name;
+		ni->sites++;
+		break;
+	}
+	case A_YIELD:
+		inline_walk(a->yld.expr, t);
+		break;
+	case A_IMPORT:
+		inline_walk(a->imp.mod->body, t);
+		break;
+	default:
+		break;
+	}
+}
+
+static size_t inline_pass(AST* prog, bool report) {
+	if(!prog || prog->tag!=A_BLOCK) return 0;
+	NameTable t= {0};
+	names_scan(prog, &t, true);
+	names_seed(&t);
+	for(size_t i=0; i<prog->block.n; i++) {
+		inline_walk(prog->block.stmts[i], &t);
+		inline_candidate(prog->block.stmts[i], &t);
+	}
+	size_t total=0;
+	for(size_t i=0; i<t.cap; i++) {
+		NameInfo* ni=&t.slots[i];
+		if(!ni->name || !ni->sites) continue;
+		if(report) fprintf(stderr, "inline: %s -> %zu call site%s\n", ni->name, ni->sites, ni->sites==1? "" : "s");
+		total+=ni->sites;
+	}
+	if(report) fprintf(stderr, "inline: %zu call site%s inlined\n", total, total==1? "" : "s");
+	names_free(&t);
+	return total;
+}
+
+/*
+ * Type inference. Types are sets of value tags, so joining is a bitwise
+ * or. As with the counts above, a name's type is the join of everything
+ * written to any binding with that name. Parameters of a function bound
+ * once at top level and only ever called directly take the join of the
+ * arguments at its call sites. All other parameters, and the results of
+ * calls to unknown functions, are TY_ANY. The pass iterates from the
+ * empty type up to a fixpoint, then marks operators whose operands are
+ * proven so that eval can skip want_num/want_bool. An operand whose type
+ * is known but can never satisfy its operator is reported, since that
+ * check fails whenever the operator is reached.
+ */
+enum { TY_NULL=1, TY_NUM=2, TY_BOOL=4, TY_FUNC=8, TY_GEN=16, TY_MAP=32, TY_ANY=63 };
+
+typedef struct {
+	NameTable names;
+	bool changed;
+	bool mark;
+	size_t sites, proven, errors;
+} TypeCtx;
+
+static void ty_join(TypeCtx* c, unsigned* slot, unsigned t) {
+	if((*slot|t)!=*slot) {
+		*slot|=t;
+		c->changed=true;
+	}
+}
+
+static const char* ty_name(unsigned t) {
+	static const char* names[] = { "null", "number", "boolean", "function", "generator", "map" };
+	for(unsigned i=0; i<6; i++) if(t==1u<<i) return names[i];
+	return "mixed";
+}
+
+static bool ty_want(TypeCtx* c, unsigned t, unsigned want, const char* op) {
+	if(!c->mark) return t==want;
+	c->sites++;
+	if(t==want) {
+		c->proven++;
+		return true;
+	}
+	if(t && !(t&want)) {
+		c->errors++;
+		fprintf(stderr, "warning: operator '%s' expects %s, got %s\n", op, ty_name(want), ty_name(t));
+	}
+	return false;
+}
+
+static unsigned ty_expr(AST* a, TypeCtx* c);
+
+static void ty_params(AST* fn, AST** args, size_t nargs, TypeCtx* c) {
+	for(size_t i=0; i<fn->fn.nparams; i++) {
+		unsigned t = args? (i<nargs? ty_expr(args[i], c) : 0) : TY_ANY;
+		ty_join(c, &names_get(&c->names, fn->fn.params[i]->id.name)->ty, t);
+	}
+}
+
+static unsigned ty_expr(AST* a, TypeCtx* c) {
+	if(!a) return TY_NULL;
+	switch(a->tag) {
+	case A_NUM:
+		return TY_NUM;
+	case A_BOOL:
+		return TY_BOOL;
+	case A_ID:
+		return names_get(&c->names, a->id.name)->ty;
+	case A_LET: {
+		const char* name=a->var_.id->id.name;
+		unsigned t;
+		if(names_get(&c->names, name)->fn==a->var_.expr) {
+			t=ty_expr(a->var_.expr->fn.body, c);
+			if(a->var_.expr->fn.gen) t=TY_GEN;
+			ty_join(c, &names_get(&c->names, name)->ret, t);
+			t=TY_FUNC;
+		} else {
+			t=ty_expr(a->var_.expr, c);
+		}
+		ty_join(c, &names_get(&c->names, name)->ty, t);
+		return t;
+	}
+	case A_ASSIGN: {
+		unsigned t=ty_expr(a->asn.expr, c);
+		ty_join(c, &names_get(&c->names, a->asn.id->id.name)->ty, t);
+		return t;
+	}
+	case A_UN: {
+		unsigned t=ty_expr(a->un.expr, c);
+		if(a->un.op==U_NEG) {
+			a->typed=ty_want(c, t, TY_NUM, "-");
+			return TY_NUM;
+		}
+		a->typed=ty_want(c, t, TY_BOOL, "!");
+		return TY_BOOL;
+	}
+	case A_BIN: {
+		static const char* ops[] = {
+			[B_ADD]="+", [B_SUB]="-", [B_MUL]="*", [B_DIV]="/", [B_MOD]="%",
+			[B_LT]="<", [B_LE]="<=", [B_GT]=">", [B_GE]=">=", [B_EQ]="==", [B_NE]="!=",
+			[B_AND]="&&", [B_OR]="||",
+		};
+		unsigned l=ty_expr(a->bin.left, c);
+		unsigned r=ty_expr(a->bin.right, c);
+		if(a->bin.op==B_EQ || a->bin.op==B_NE) return TY_BOOL;
+		unsigned want = a->bin.op>=B_AND? TY_BOOL : TY_NUM;
+		bool lt=ty_want(c, l, want, ops[a->bin.op]);
+		bool rt=ty_want(c, r, want, ops[a->bin.op]);
+		a->typed = lt && rt;
+		return a->bin.op<=B_MOD? TY_NUM : TY_BOOL;
+	}
+	case A_BLOCK: {
+		unsigned t=TY_NULL;
+		for(size_t i=0; i<a->block.n; i++) t=ty_expr(a->block.stmts[i], c);
+		return t;
+	}
+	case A_IFELSE: {
+		unsigned t=0;
+		bool typed=true;
+		for(size_t i=0; i<a->iff.n; i++) {
+			typed &= ty_want(c, ty_expr(a->iff.conds[i], c), TY_BOOL, "if/elif");
+			t|=ty_expr(a->iff.bodies[i], c);
+		}
+		a->typed=typed;
+		return t|ty_expr(a->iff.elseBody, c);
+	}
+	case A_WHILE:
+		a->typed=ty_want(c, ty_expr(a->wh.cond, c), TY_BOOL, "while");
+		return TY_NULL|ty_expr(a->wh.body, c);
+	case A_FOR: {
+		bool from=ty_want(c, ty_expr(a->fr.from, c), TY_NUM, "for");
+		bool to=ty_want(c, ty_expr(a->fr.to, c), TY_NUM, "for");
+		a->typed = from && to;
+		ty_join(c, &names_get(&c->names, a->fr.id->id.name)->ty, TY_NUM);
+		return TY_NULL|ty_expr(a->fr.body, c);
+	}
+	case A_FUNC_LIT:
+		ty_params(a, NULL, 0, c);
+		ty_expr(a->fn.body, c);
+		return TY_FUNC;
+	case A_CALL: {
+		unsigned t=ty_expr(a->call.callee, c);
+		const char* name = a->call.callee->tag==A_ID? a->call.callee->id.name : NULL;
+		AST* fn = name? names_get(&c->names, name)->fn : NULL;
+		if(fn) {
+			ty_params(fn, a->call.args, a->call.nargs, c);
+			return names_get(&c->names, name)->ret;
+		}
+		for(size_t i=0; i<a->call.nargs; i++) ty_expr(a->call.args[i], c);
+		return t? TY_ANY : 0;
+	}
+	case A_BUILTIN: {
+		unsigned t0=0, t=0;
+		for(size_t i=0; i<a->builtin.nargs; i++) {
+			t=ty_expr(a->builtin.args[i], c);
+			if(!i) t0=t;
+		}
+		switch(a->builtin.bi) {
+		case BUILTIN_OUTN:
+		case BUILTIN_DONE:
+			return TY_BOOL;
+		case BUILTIN_NEXT:
+			return TY_ANY;
+		case BUILTIN_MAP:
+			return TY_MAP;
+		default:
+			break;
+		}
+		static const char* ops[] = { [BUILTIN_INDEX]="[]", [BUILTIN_GET]="get", [BUILTIN_SET]="set", [BUILTIN_HAS]="has", [BUILTIN_DELETE]="delete", [BUILTIN_SIZE]="size" };
+		ty_want(c, t0, TY_MAP, ops[a->builtin.bi]);
+		switch(a->builtin.bi) {
+		case BUILTIN_HAS:
+		case BUILTIN_DELETE:
+			return TY_BOOL;
+		case BUILTIN_SIZE:
+			return TY_NUM;
+		case BUILTIN_SET:
+			return t;
+		default:
+			return TY_ANY;
+		}
+	}
+	case A_YIELD:
+		ty_expr(a->yld.expr, c);
+		return TY_NULL;
+	case A_IMPORT:
+		ty_expr(a->imp.mod->body, c);
+		return TY_NULL;
+	default:
+		return TY_ANY;
+	}
+}
+
+static size_t type_pass(AST* prog, bool report) {
+	if(!prog || prog->tag!=A_BLOCK) return 0;
+	TypeCtx c= {0};
+	names_scan(prog, &c.names, true);
+	names_seed(&c.names);
+	for(size_t i=0; i<image_nnames; i++) names_get(&c.names, image_names[i])->ty=TY_ANY;
+	for(size_t i=0; i<prog->block.n; i++) {
+		AST* s=prog->block.stmts[i];
+		if(s->tag!=A_LET || s->var_.expr->tag!=A_FUNC_LIT) continue;
+		NameInfo* ni=names_get(&c.names, s->var_.id->id.name);
+		if(ni->binds!=1 || ni->assigns || ni->reads) continue;
+		ni->fn=s->var_.expr;
+	}
+	do {
+		c.changed=false;
+		ty_expr(prog, &c);
+	} while(c.changed);
+	c.mark=true;
+	ty_expr(prog, &c);
+	if(report) fprintf(stderr, "types: %zu of %zu operand check%s proven\n", c.proven, c.sites, c.sites==1? "" : "s");
+	names_free(&c.names);
+	return c.errors;
+}
+
+/*
+ * Execution budgets. The fuel counter is decremented only at loop back
+ * edges and calls, so a script cannot run forever without passing one of
+ * them. The SIGALRM handler for --timeout drains the fuel, which lets the
+ * deadline ride on the same single branch instead of polling the clock.
+ */
+static volatile long budget_fuel = LONG_MAX;
+static volatile sig_atomic_t budget_timed_out = 0;
+static long budget_steps = 0;
+static double budget_timeout = 0;
+static size_t heap_used = 0;
+static size_t heap_max = SIZE_MAX;
+
+static void budget_exhausted(void) {
+	if(budget_timed_out) dief("timeout: execution exceeded %gs", budget_timeout);
+	if(budget_steps>0) dief("step budget exhausted after %ld steps", budget_steps);
+	budget_fuel = LONG_MAX;
+}
+
+#define BUDGET_STEP() do { if(--budget_fuel<=0) budget_exhausted(); } while(0)
+
+static void heap_exhausted(void) {
+	dief("heap budget exhausted: %zu bytes allowed", heap_max);
+}
+
+#define HEAP_CHARGE(n) do { if((heap_used+=(n))>heap_max) heap_exhausted(); } while(0)
+
+/* the budget is on live bytes; --stats keeps counting every allocation */
+#define HEAP_CREDIT(n) (heap_used-=(n))
+
+static void budget_on_alarm(int sig) {
+	(void)sig;
+	budget_timed_out = 1;
+	budget_fuel = 0;
+}
+
+static void budget_start(void) {
+	budget_fuel = budget_steps>0? budget_steps : LONG_MAX;
+	budget_timed_out = 0;
+	if(budget_timeout>0) {
+		struct sigaction sa;
+		memset(&sa, 0, sizeof sa);
+		sa.sa_handler = budget_on_alarm;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGALRM, &sa, NULL);
+		/* re-fire every 10ms in case a racing decrement overwrote the zero */
+		struct itimerval it;
+		it.it_value.tv_sec = (time_t)budget_timeout;
+		it.it_value.tv_usec = (suseconds_t)((budget_timeout-(double)it.it_value.tv_sec)*1e6);
+		if(it.it_value.tv_sec==0 && it.it_value.tv_usec==0) it.it_value.tv_usec=1;
+		it.it_interval.tv_sec = 0;
+		it.it_interval.tv_usec = 10000;
+		setitimer(ITIMER_REAL, &it, NULL);
+	}
+}
+
+static void budget_stop(void) {
+	if(budget_timeout>0) {
+		struct itimerval it;
+		memset(&it, 0, sizeof it);
+		setitimer(ITIMER_REAL, &it, NULL);
+	}
+}
+
+/*
+ * Sampling profiler. Every call pushes the callee and the line it was
+ * called from onto a shadow stack, and every statement stores its line;
+ * both are plain stores that stay compiled in. --sample-profile=HZ arms
+ * a SIGPROF timer whose handler folds the shadow stack into a fixed table
+ * of distinct stacks, so it never allocates. At exit the table is written
+ * as collapsed stacks, one "main:LINE;f:LINE;... COUNT" line per stack,
+ * where each frame's line is the one it was executing when sampled.
+ */
+#define PROF_STACK (64*1024)
+#define PROF_DEPTH 256 /* innermost frames kept per sample */
+#define PROF_SLOTS 4096
+#define PROF_ARENA (1024*1024)
+
+typedef struct {
+	const AST* fn;
+	uint32_t line; /* of the call, in the caller */
+} ProfFrame;
+
+typedef struct {
+	uint64_t hash;
+	uint32_t off, n, line;
+	bool cut;
+	unsigned long long count;
+} ProfSlot;
+
+static ProfFrame prof_stack[PROF_STACK];
+static volatile size_t prof_sp = 0;
+static volatile uint32_t prof_line = 0;
+static long prof_hz = 0;
+static const char* prof_out = NULL;
+static ProfSlot* prof_slots = NULL;
+static ProfFrame* prof_arena = NULL;
+static size_t prof_used = 0;
+static unsigned long long prof_samples = 0, prof_lost = 0;
+
+#define PROF_PUSH(f, l) do { \
+	size_t sp_=prof_sp; \
+	if(sp_<PROF_STACK) prof_stack[sp_]=(ProfFrame){ (f), (l) }; \
+	prof_sp=sp_+1; \
+	prof_line=(f)->line; \
+} while(0)
+#define PROF_POP(l) do { prof_sp--; prof_line=(l); } while(0)
+
+static void prof_on_sample(int sig) {
+	(void)sig;
+	size_t sp=prof_sp, n = sp<PROF_STACK? sp : PROF_STACK;
+	size_t lo = n>PROF_DEPTH? n-PROF_DEPTH : 0;
+	uint32_t line=prof_line;
+	bool cut = lo>0 || sp>PROF_STACK;
+	uint64_t h=1469598103934665603ull^line;
+	for(size_t i=lo; i<n; i++) {
+		h=(h^(uintptr_t)prof_stack[i].fn)*1099511628211ull;
+		h=(h^prof_stack[i].line)*1099511628211ull;
+	}
+	prof_samples++;
+	for(size_t k=0, j=h&(PROF_SLOTS-1); k<PROF_SLOTS; k++, j=(j+1)&(PROF_SLOTS-1)) {
+		ProfSlot* s=&prof_slots[j];
+		if(!s->count) {
+			if(prof_used+(n-lo)>PROF_ARENA) break;
+			for(size_t i=lo; i<n; i++) prof_arena[prof_used+i-lo]=prof_stack[i];
+			*s=(ProfSlot) {
+				.hash=h, .off=(uint32_t)prof_used, .n=(uint32_t)(n-lo), .line=line, .cut=cut, .count=1
+			};
+			prof_used+=n-lo;
+			return;
+		}
+		if(s->hash!=h || s->n!=n-lo || s->line!=line || s->cut!=cut) continue;
+		size_t i=0;
+		for(; i<s->n; i++) {
+			const ProfFrame* f=&prof_arena[s->off+i];
+			if(f->fn!=prof_stack[lo+i].fn || f->line!=prof_stack[lo+i].line) break;
+		}
+		if(i==s->n) {
+			s->count++;
+			return;
+		}
+	}
+	prof_lost++;
+}
+
+static void prof_frame(FILE* f, const AST* fn, uint32_t line) {
+	if(fn->fn.name) fprintf(f, ";%s:%u", fn->fn.name, line);
+	else fprintf(f, ";func@%u:%u", (unsigned)fn->line, line);
+}
+
+static void prof_report(void) {
+	struct itimerval it;
+	memset(&it, 0, sizeof it);
+	setitimer(ITIMER_PROF, &it, NULL);
+	signal(SIGPROF, SIG_IGN);
+	FILE* f = prof_out? fopen(prof_out, "w") : stderr;
+	if(!f) {
+		fprintf(stderr, "could not write profile: %s\n", prof_out);
+		return;
+	}
+	for(size_t j=0; j<PROF_SLOTS; j++) {
+		const ProfSlot* s=&prof_slots[j];
+		if(!s->count) continue;
+		const ProfFrame* fr=&prof_arena[s->off];
+		if(s->cut) fprintf(f, "...");
+		else fprintf(f, "main:%u", s->n? fr[0].line : s->line);
+		for(uint32_t i=0; i<s->n; i++) prof_frame(f, fr[i].fn, i+1<s->n? fr[i+1].line : s->line);
+		fprintf(f, " %llu\n", s->count);
+	}
+	if(f!=stderr) fclose(f);
+	if(prof_lost) fprintf(stderr, "profile: %llu of %llu samples dropped, too many distinct stacks\n", prof_lost, prof_samples);
+}
+
+static void prof_start(void) {
+	if(prof_hz<=0) return;
+	prof_slots=(ProfSlot*)calloc(PROF_SLOTS, sizeof(ProfSlot));
+	prof_arena=(ProfFrame*)malloc(PROF_ARENA*sizeof(ProfFrame));
+	if(!prof_slots || !prof_arena) die("out of memory");
+	atexit(prof_report);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = prof_on_sample;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGPROF, &sa, NULL);
+	struct itimerval it;
+	it.it_interval.tv_sec = 0;
+	it.it_interval.tv_usec = prof_hz>=1000000? 1 : 1000000/prof_hz;
+	it.it_value = it.it_interval;
+	setitimer(ITIMER_PROF, &it, NULL);
+}
+
+/*
+ * Hardware counters. --perf-counters opens one perf_event_open counter
+ * per event on this thread, user space only, and reads them all at each
+ * phase boundary, so a phase's counts are the differences. Counts are
+ * scaled when the kernel multiplexes. Events the kernel refuses, as most
+ * hardware events are inside containers, are left out and printed as
+ * '-'.
+ */
+enum { PERF_CYCLES, PERF_INSNS, PERF_BRANCH, PERF_L1D, PERF_LLC, PERF_FAULTS, PERF_NEVENTS };
+
+static const char* perf_names[PERF_NEVENTS] = {
+	"cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses", "page-faults",
+};
+
+typedef struct {
+	char label[24];
+	double ms;
+	uint64_t v[PERF_NEVENTS];
+} PerfRow;
+
+static int perf_fd[PERF_NEVENTS];
+static bool perf_on = false;
+static bool perf_stmts = false; /* a row per top level statement */
+static char perf_label[24]; /* of the running phase, empty when none is */
+static double perf_t;
+static uint64_t perf_last[PERF_NEVENTS];
+static PerfRow* perf_rows = NULL;
+static size_t perf_nrows = 0, perf_rcap = 0;
+
+static void perf_read(uint64_t* out) {
+#ifdef __linux__
+	for(int k=0; k<PERF_NEVENTS; k++) {
+		uint64_t r[3];
+		out[k]=0;
+		if(perf_fd[k]<0 || read(perf_fd[k], r, sizeof r)!=(ssize_t)sizeof r) continue;
+		out[k] = r[2] && r[2]<r[1]? (uint64_t)((double)r[0]*r[1]/r[2]) : r[0];
+	}
+#else
+	memset(out, 0, PERF_NEVENTS*sizeof(uint64_t));
+#endif
+}
+
+/* closes the running phase into a row and starts 'next', NULL to stop */
+static void perf_phase(const char* next) {
+	if(!perf_on) return;
+	uint64_t now[PERF_NEVENTS];
+	perf_read(now);
+	double t=now_ms();
+	if(*perf_label) {
+		if(perf_nrows==perf_rcap) {
+			perf_rcap = perf_rcap? perf_rcap*2 : 16;
+			perf_rows=(PerfRow*)realloc(perf_rows, perf_rcap*sizeof(PerfRow));
+			if(!perf_rows) die("out of memory");
+		}
+		PerfRow* r=&perf_rows[perf_nrows++];
+		memcpy(r->label, perf_label, sizeof perf_label);
+		r->ms=t-perf_t;
+		for(int k=0; k<PERF_NEVENTS; k++) r->v[k]=now[k]-perf_last[k];
+	}
+	memcpy(perf_last, now, sizeof now);
+	perf_t=t;
+	snprintf(perf_label, sizeof perf_label, "%s", next? next : "");
+}
+
+static void perf_row(const PerfRow* r) {
+	fprintf(stderr, "%-14s %10.3f", r->label, r->ms);
+	for(int k=0; k<PERF_NEVENTS; k++) {
+		if(perf_fd[k]<0) fprintf(stderr, " %14s", "-");
+		else fprintf(stderr, " %14llu", (unsigned long long)r->v[k]);
+	}
+	fprintf(stderr, "\n");
+}
+
+static void perf_report(void) {
+	perf_phase(NULL);
+	fprintf(stderr, "%-14s %10s", "phase", "ms");
+	for(int k=0; k<PERF_NEVENTS; k++) fprintf(stderr, " %14s", perf_names[k]);
+	fprintf(stderr, "\n");
+	PerfRow total= {.label="total"};
+	for(size_t i=0; i<perf_nrows; i++) {
+		perf_row(&perf_rows[i]);
+		total.ms+=perf_rows[i].ms;
+		for(int k=0; k<PERF_NEVENTS; k++) total.v[k]+=perf_rows[i].v[k];
+	}
+	perf_row(&total);
+}
+
+static void perf_start(void) {
+#ifdef __linux__
+	static const struct {
+		uint32_t type;
+		uint64_t config;
+	} ev[PERF_NEVENTS] = {
+		[PERF_CYCLES]= {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+		[PERF_INSNS]= {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+		[PERF_BRANCH]= {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+		[PERF_L1D]= {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ<<8 | PERF_COUNT_HW_CACHE_RESULT_MISS<<16},
+		[PERF_LLC]= {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+		[PERF_FAULTS]= {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+	};
+	int opened=0, err=0;
+	char missing[128]="";
+	for(int k=0; k<PERF_NEVENTS; k++) {
+		struct perf_event_attr a;
+		memset(&a, 0, sizeof a);
+		a.size=sizeof a;
+		a.type=ev[k].type;
+		a.config=ev[k].config;
+		a.exclude_kernel=1;
+		a.exclude_hv=1;
+		a.read_format=PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING;
+		perf_fd[k]=(int)syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+		if(perf_fd[k]>=0) {
+			opened++;
+			continue;
+		}
+		if(!err) err=errno;
+		snprintf(missing+strlen(missing), sizeof missing-strlen(missing), "%s%s", *missing? ", " : "", perf_names[k]);
+	}
+	if(!opened) {
+		fprintf(stderr, "perf counters: unavailable (%s), running without them\n", strerror(err));
+		return;
+	}
+	if(*missing) fprintf(stderr, "perf counters: %s unavailable (%s)\n", missing, strerror(err));
+	perf_on=true;
+	atexit(perf_report);
+#else
+	fprintf(stderr, "perf counters: not supported on this platform\n");
+#endif
+}
+
 typedef enum {
 	V_NULL,
 	V_NUM,
 	V_BOOL,
-	V_FUNC
+	V_FUNC,
+	V_GEN,
+	V_MAP
 } VTag;
 
 typedef struct Env Env;
+typedef struct Gen Gen;
+typedef struct Map Map;
 typedef struct {
 	AST* fun;
 	Env* env;
@@ -805,6 +2410,8 @@ typedef struct {
 		int i;
 		bool b;
 		Closure* fn;
+		Gen* gen;
+		Map* map;
 	} as;
 } Val;
 
@@ -814,278 +2421,1240 @@ static Val VNull(void) {
 	return v;
 }
 
-static Val VNum(int x) {
-	Val v;
-	v.tag=V_NUM;
-	v.as.i=x;
-	return v;
+static Val VNum(int x) {
+	Val v;
+	v.tag=V_NUM;
+	v.as.i=x;
+	return v;
+}
+
+static Val VBool(bool b) {
+	Val v;
+	v.tag=V_BOOL;
+	v.as.b=b;
+	return v;
+}
+
+static Val VFunc(AST* f, Env* e) {
+	Closure* c=(Closure*)malloc(sizeof(Closure));
+	c->fun=f;
+	c->env=e;
+	Val v;
+	v.tag=V_FUNC;
+	v.as.fn=c;
+	return v;
+}
+
+/*
+ * Maps are Swiss tables. Every slot has a control byte that is empty,
+ * deleted, or the low seven bits of its key's hash, and a lookup compares
+ * a group of sixteen control bytes against that fragment at once, so only
+ * keys whose fragment matches are ever loaded. The slots follow their
+ * control bytes in the same allocation. Keys are numbers and booleans,
+ * packed with their tag into one word.
+ */
+#define MAP_GROUP 16
+#define MAP_EMPTY ((int8_t)-128)
+#define MAP_DELETED ((int8_t)-2)
+
+typedef struct {
+	uint64_t key;
+	Val val;
+} MapSlot;
+
+struct Map {
+	int8_t* ctrl; /* cap control bytes, then cap slots */
+	size_t cap, size;
+	size_t used; /* full and deleted slots */
+	bool owned; /* ctrl came from malloc rather than an image */
+};
+
+#define MAP_SLOTS(m) ((MapSlot*)((m)->ctrl+(m)->cap))
+
+static uint64_t map_key(Val k) {
+	if(k.tag==V_NUM) return (uint32_t)k.as.i;
+	if(k.tag==V_BOOL) return (uint64_t)1<<32 | k.as.b;
+	die("map keys must be numbers or booleans");
+	return 0;
+}
+
+static inline uint64_t map_hash(uint64_t k) {
+	k*=0x9E3779B97F4A7C15ull;
+	return k^k>>32;
+}
+
+/* bit i is set when control byte i of the group equals c */
+static inline unsigned map_match(const int8_t* g, int8_t c) {
+#if LEX_SIMD
+	return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)g), _mm_set1_epi8(c)));
+#else
+	unsigned m=0;
+	for(unsigned i=0; i<MAP_GROUP; i++) m|=(unsigned)(g[i]==c)<<i;
+	return m;
+#endif
+}
+
+/* empty and deleted bytes are the ones with the top bit set */
+static inline unsigned map_free(const int8_t* g) {
+#if LEX_SIMD
+	return (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)g));
+#else
+	unsigned m=0;
+	for(unsigned i=0; i<MAP_GROUP; i++) m|=(unsigned)(g[i]<0)<<i;
+	return m;
+#endif
+}
+
+/*
+ * Probing moves between groups by triangular steps, which visits every
+ * group of a power of two table, and stops at the first group with an
+ * empty byte: an insert would have used it.
+ */
+static MapSlot* map_find(const Map* m, uint64_t k) {
+	uint64_t h=map_hash(k);
+	size_t mask=m->cap/MAP_GROUP-1, g=(h>>7)&mask;
+	MapSlot* s=MAP_SLOTS(m);
+	for(size_t step=1;; step++) {
+		const int8_t* c=m->ctrl+g*MAP_GROUP;
+		for(unsigned bits=map_match(c, (int8_t)(h&0x7f)); bits; bits&=bits-1) {
+			MapSlot* it=&s[g*MAP_GROUP+__builtin_ctz(bits)];
+			if(it->key==k) return it;
+		}
+		if(map_match(c, MAP_EMPTY)) return NULL;
+		g=(g+step)&mask;
+	}
+}
+
+/* stores a key known to be absent */
+static void map_put(Map* m, uint64_t k, Val v) {
+	uint64_t h=map_hash(k);
+	size_t mask=m->cap/MAP_GROUP-1, g=(h>>7)&mask;
+	unsigned bits;
+	for(size_t step=1; !(bits=map_free(m->ctrl+g*MAP_GROUP)); step++) g=(g+step)&mask;
+	size_t i=g*MAP_GROUP+__builtin_ctz(bits);
+	if(m->ctrl[i]==MAP_EMPTY) m->used++;
+	m->ctrl[i]=(int8_t)(h&0x7f);
+	MAP_SLOTS(m)[i]=(MapSlot) {
+		.key=k, .val=v
+	};
+	m->size++;
+}
+
+/* a table's control bytes and slots */
+static size_t map_bytes(const Map* m) {
+	return m->cap+m->cap*sizeof(MapSlot);
+}
+
+static void map_alloc(Map* m, size_t cap) {
+	m->ctrl=(int8_t*)malloc(cap+cap*sizeof(MapSlot));
+	if(!m->ctrl) die("out of memory");
+	memset(m->ctrl, MAP_EMPTY, cap);
+	m->cap=cap;
+	m->size=m->used=0;
+	m->owned=true;
+}
+
+static void map_rehash(Map* m, size_t cap) {
+	Map old=*m;
+	map_alloc(m, cap);
+	MapSlot* s=MAP_SLOTS(&old);
+	for(size_t i=0; i<old.cap; i++) if(old.ctrl[i]>=0) map_put(m, s[i].key, s[i].val);
+	if(old.owned) free(old.ctrl);
+}
+
+/* tables stay at most 7/8 used; past that they double, or are rebuilt in place when deletions left the room */
+static void map_set(Map* m, Val k, Val v) {
+	uint64_t key=map_key(k);
+	MapSlot* it=map_find(m, key);
+	if(it) {
+		it->val=v;
+		return;
+	}
+	if((m->used+1)*8>m->cap*7) map_rehash(m, (m->size+1)*2>m->cap? m->cap*2 : m->cap);
+	map_put(m, key, v);
+}
+
+static bool map_delete(Map* m, Val k) {
+	MapSlot* it=map_find(m, map_key(k));
+	if(!it) return false;
+	size_t i=(size_t)(it-MAP_SLOTS(m));
+	/* a group that still has an empty byte never sent a probe further */
+	if(map_match(m->ctrl+(i&~(size_t)(MAP_GROUP-1)), MAP_EMPTY)) {
+		m->ctrl[i]=MAP_EMPTY;
+		m->used--;
+	} else {
+		m->ctrl[i]=MAP_DELETED;
+	}
+	m->size--;
+	return true;
+}
+
+static Val VMap(size_t n) {
+	Map* m=(Map*)malloc(sizeof(Map));
+	if(!m) die("out of memory");
+	size_t cap=MAP_GROUP;
+	while(n*8>cap*7) cap*=2;
+	map_alloc(m, cap);
+	Val v;
+	v.tag=V_MAP;
+	v.as.map=m;
+	return v;
+}
+
+static Map* want_map(Val v, const char* name) {
+	if(v.tag!=V_MAP) dief("%s expects a map", name);
+	return v.as.map;
+}
+
+typedef struct Entry {
+	char* name;
+	Val val;
+	bool constant;
+	bool boxed; /* referenced from a closure's cells */
+	struct Entry* next;
+} Entry;
+
+/*
+ * A closure's Env holds only the bindings its function mentions, as
+ * cells pointing at the Entries they resolved to when it was created,
+ * and its parent is the global Env. A call Env that no closure holds as
+ * its parent is freed on return, minus the Entries that were boxed.
+ */
+struct Env {
+	Entry* head;
+	Env* parent;
+	Entry** cells;
+	size_t ncells;
+	bool stack;
+	bool captured;
+};
+
+static Env* env_new(Env* parent) {
+	Env* e=(Env*)calloc(1,sizeof(Env));
+	e->parent=parent;
+	return e;
+}
+
+/*
+ * Frame stack for calls whose environment cannot escape. Frames are
+ * carved out of chained chunks and released wholesale when the call
+ * returns; chunks are kept for reuse, so steady state recursion does not
+ * touch malloc at all.
+ */
+#define FRAME_CHUNK (64*1024)
+
+typedef struct FrameChunk {
+	struct FrameChunk* prev;
+	struct FrameChunk* next;
+	size_t top;
+	char data[FRAME_CHUNK];
+} FrameChunk;
+
+typedef struct {
+	FrameChunk* chunk;
+	size_t top;
+} FrameMark;
+
+static FrameChunk* frames = NULL;
+
+static FrameChunk* frame_chunk_new(FrameChunk* prev) {
+	FrameChunk* c=(FrameChunk*)malloc(sizeof(FrameChunk));
+	if(!c) die("out of memory");
+	c->prev=prev;
+	c->next=NULL;
+	c->top=0;
+	if(prev) prev->next=c;
+	return c;
+}
+
+static FrameMark frame_mark(void) {
+	if(!frames) frames=frame_chunk_new(NULL);
+	return (FrameMark) {
+		.chunk=frames, .top=frames->top
+	};
+}
+
+static void frame_release(FrameMark m) {
+	frames=m.chunk;
+	frames->top=m.top;
+}
+
+/* frees the whole chain c belongs to, once no frame on it is live */
+static void frame_chunks_free(FrameChunk* c) {
+	if(!c) return;
+	while(c->prev) c=c->prev;
+	while(c) {
+		FrameChunk* next=c->next;
+		free(c);
+		c=next;
+	}
+}
+
+static void* frame_alloc(size_t n) {
+	n=(n+15)&~(size_t)15;
+	if(frames->top+n>FRAME_CHUNK) {
+		frames = frames->next? frames->next : frame_chunk_new(frames);
+		frames->top=0;
+	}
+	void* p=frames->data+frames->top;
+	frames->top+=n;
+	return p;
+}
+
+static void want_num(Val v, const char* op) {
+	if(v.tag!=V_NUM) dief("operator '%s' expects number", op);
+}
+
+static void want_bool(Val v, const char* op) {
+	if(v.tag!=V_BOOL) dief("operator '%s' expects boolean", op);
+}
+
+/* argument slots of the innermost A_INLINE body being evaluated */
+static Val* inline_frame = NULL;
+
+static Val eval_lean(AST* a, Env* env);
+static Val eval_guard(AST* a, Env* env);
+static Val eval_instr(AST* a, Env* env);
+static void env_release_lean(Env* e);
+static void env_release_guard(Env* e);
+static void env_release_instr(Env* e);
+/* the variant main picked, for code outside the template */
+static Val (*eval)(AST* a, Env* env) = eval_lean;
+static void (*env_release)(Env* e) = env_release_lean;
+
+/*
+ * Generators. Calling a function whose body yields binds its arguments
+ * and returns a generator without running the body. The body runs as a
+ * coroutine on its own stack, so a yield can suspend it anywhere inside
+ * nested expressions; next() and done() resume it until the following
+ * yield or the end of the body. Each coroutine has its own frame stack,
+ * inline slots and error handler, which are swapped in on every resume.
+ * On x86-64 the switch saves the callee saved registers and exchanges
+ * stack pointers; elsewhere every generator is a thread and control is
+ * handed over with a condition variable, so only one side runs at once.
+ * A generator's stack and frame chunks are freed when it finishes.
+ * Nothing tracks whether an unfinished one is still reachable, so one
+ * that is dropped part way through keeps them until exit.
+ */
+#define GEN_STACK (8*1024*1024)
+
+typedef struct {
+	FrameChunk* frames;
+	Val* inline_frame;
+	jmp_buf* die_jmp;
+	unsigned long long depth;
+	Gen* current;
+} CoroState;
+
+struct Gen {
+	AST* fun;
+	Env* env;
+	Val val;
+	bool has_val, done, failed, running, started;
+	CoroState st;
+	jmp_buf jb;
+#if GEN_ASM
+	void* sp;
+	void* back_sp;
+	char* stack;
+#else
+	pthread_t thread;
+	pthread_cond_t cond;
+	bool turn;
+#endif
+};
+
+static Gen* gen_current = NULL;
+
+static void coro_save(CoroState* s) {
+	s->frames=frames;
+	s->inline_frame=inline_frame;
+	s->die_jmp=die_jmp;
+	s->depth=stats.depth;
+	s->current=gen_current;
+}
+
+static void coro_load(const CoroState* s) {
+	frames=s->frames;
+	inline_frame=s->inline_frame;
+	die_jmp=s->die_jmp;
+	stats.depth=s->depth;
+	gen_current=s->current;
+}
+
+static Val VGen(AST* f, Env* e) {
+	Gen* g=(Gen*)calloc(1, sizeof(Gen));
+	g->fun=f;
+	g->env=e;
+	g->st.current=g;
+	Val v;
+	v.tag=V_GEN;
+	v.as.gen=g;
+	return v;
+}
+
+/* runs the body on the generator's stack; errors land back here */
+static void gen_body(Gen* g) {
+	if(setjmp(g->jb)==0) {
+		die_jmp=&g->jb;
+		(void)eval(g->fun->fn.body, g->env);
+		env_release(g->env);
+	} else {
+		g->failed=true;
+	}
+	g->done=true;
+}
+
+#if GEN_ASM
+void slug_coro_switch(void** save, void* to);
+__asm__(
+	".text\n"
+	".globl slug_coro_switch\n"
+	".type slug_coro_switch, @function\n"
+	"slug_coro_switch:\n"
+	"\tpushq %rbp\n\tpushq %rbx\n\tpushq %r12\n\tpushq %r13\n\tpushq %r14\n\tpushq %r15\n"
+	"\tmovq %rsp, (%rdi)\n"
+	"\tmovq %rsi, %rsp\n"
+	"\tpopq %r15\n\tpopq %r14\n\tpopq %r13\n\tpopq %r12\n\tpopq %rbx\n\tpopq %rbp\n"
+	"\tret\n"
+);
+
+static void gen_entry(void) {
+	Gen* g=gen_current;
+	gen_body(g);
+	slug_coro_switch(&g->sp, g->back_sp);
+}
+
+static void gen_switch_in(Gen* g) {
+	if(!g->started) {
+		g->started=true;
+		g->stack=(char*)mmap(NULL, GEN_STACK, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+		if(g->stack==MAP_FAILED) die("out of memory");
+		/* the lowest page stays unmapped so that overflow faults like the main stack */
+		mprotect(g->stack, 4096, PROT_NONE);
+		void** top=(void**)(g->stack+GEN_STACK);
+		*--top=NULL;
+		*--top=(void*)gen_entry;
+		for(int i=0; i<6; i++) *--top=NULL;
+		g->sp=top;
+	}
+	slug_coro_switch(&g->back_sp, g->sp);
+	if(g->done) {
+		munmap(g->stack, GEN_STACK);
+		g->stack=NULL;
+	}
+}
+
+static void gen_switch_out(Gen* g) {
+	slug_coro_switch(&g->sp, g->back_sp);
 }
+#else
+static pthread_mutex_t gen_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static Val VBool(bool b) {
-	Val v;
-	v.tag=V_BOOL;
-	v.as.b=b;
-	return v;
+static void* gen_thread(void* arg) {
+	Gen* g=(Gen*)arg;
+	coro_load(&g->st);
+	gen_body(g);
+	pthread_mutex_lock(&gen_lock);
+	g->turn=false;
+	pthread_cond_signal(&g->cond);
+	pthread_mutex_unlock(&gen_lock);
+	return NULL;
 }
 
-static Val VFunc(AST* f, Env* e) {
-	Closure* c=(Closure*)malloc(sizeof(Closure));
-	c->fun=f;
-	c->env=e;
-	Val v;
-	v.tag=V_FUNC;
-	v.as.fn=c;
-	return v;
+static void gen_switch_in(Gen* g) {
+	pthread_mutex_lock(&gen_lock);
+	g->turn=true;
+	if(!g->started) {
+		g->started=true;
+		pthread_cond_init(&g->cond, NULL);
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, GEN_STACK);
+		if(pthread_create(&g->thread, &attr, gen_thread, g)!=0) die("cannot start generator");
+		pthread_attr_destroy(&attr);
+	} else {
+		pthread_cond_signal(&g->cond);
+	}
+	while(g->turn) pthread_cond_wait(&g->cond, &gen_lock);
+	pthread_mutex_unlock(&gen_lock);
+	if(g->done) pthread_join(g->thread, NULL);
 }
 
-typedef struct Entry {
-	char* name;
-	Val val;
-	bool constant;
-	struct Entry* next;
-} Entry;
+static void gen_switch_out(Gen* g) {
+	pthread_mutex_lock(&gen_lock);
+	g->turn=false;
+	pthread_cond_signal(&g->cond);
+	while(!g->turn) pthread_cond_wait(&g->cond, &gen_lock);
+	pthread_mutex_unlock(&gen_lock);
+}
+#endif
 
-struct Env {
-	Entry* head;
-	Env* parent;
-};
+/* runs g up to its next yield or its end */
+static void gen_advance(Gen* g) {
+	if(g->running) die("generator is already running");
+	CoroState back;
+	coro_save(&back);
+	coro_load(&g->st);
+	g->running=true;
+	uint32_t line=prof_line;
+	PROF_PUSH(g->fun, line);
+	gen_switch_in(g);
+	PROF_POP(line);
+	g->running=false;
+	coro_save(&g->st);
+	coro_load(&back);
+	if(g->done) {
+		frame_chunks_free(g->st.frames);
+		g->st.frames=NULL;
+	}
+	if(g->failed) die_exit();
+}
 
-static Env* env_new(Env* parent) {
-	Env* e=(Env*)calloc(1,sizeof(Env));
-	e->parent=parent;
-	return e;
+static void gen_yield(Val v) {
+	Gen* g=gen_current;
+	if(!g) die("yield outside generator");
+	g->val=v;
+	g->has_val=true;
+	gen_switch_out(g);
 }
 
-static Entry* env_find_here(Env* e, const char* name) {
-	for(Entry* it=e->head; it; it=it->next) if(strcmp(it->name,name)==0) return it;
-	return NULL;
+static Gen* want_gen(Val v, const char* name) {
+	if(v.tag!=V_GEN) dief("%s expects a generator", name);
+	return v.as.gen;
 }
 
-static Entry* env_find(Env* e, const char* name) {
-	for(Env* cur=e; cur; cur=cur->parent) {
-		Entry* en=env_find_here(cur,name);
-		if(en) return en;
+/*
+ * The evaluator comes in three variants built from slug_eval.h: a lean
+ * one for plain runs, a guarded one that main selects for a budget or
+ * the profiler, and an instrumented one with every hook that --stats
+ * or --instrumented selects.
+ */
+#define EV(name) name##_lean
+#define EV_STATS 0
+#define EV_GUARDS 0
+#include "slug_eval.h"
+
+#define EV(name) name##_guard
+#define EV_STATS 0
+#define EV_GUARDS 1
+#include "slug_eval.h"
+
+#define EV(name) name##_instr
+#define EV_STATS 1
+#define EV_GUARDS 1
+#include "slug_eval.h"
+
+/*
+ * C backend. --emit-c translates the parsed program into C that links
+ * against slug_rt.h. Every node becomes straight line code on rt_val
+ * temporaries, in the interpreter's evaluation order, and each function
+ * literal becomes one C function taking its call environment. Names are
+ * emitted once as static strings, so the runtime compares them by address.
+ */
+typedef struct {
+	char* s;
+	size_t n, cap;
+} StrBuf;
+
+static void sb_vprintf(StrBuf* b, const char* fmt, va_list ap) {
+	va_list aq;
+	va_copy(aq, ap);
+	int k=vsnprintf(NULL, 0, fmt, aq);
+	va_end(aq);
+	if(b->n+(size_t)k+1>b->cap) {
+		while(b->n+(size_t)k+1>b->cap) b->cap = b->cap? b->cap*2 : 1024;
+		b->s=(char*)realloc(b->s, b->cap);
 	}
-	return NULL;
+	vsnprintf(b->s+b->n, (size_t)k+1, fmt, ap);
+	b->n+=(size_t)k;
 }
-static void env_define(Env* e, const char* name, Val v, bool c) {
-	Entry* en=env_find(e,name);
-	if(en) {
-		if(en->constant) dief("cannot reassign const %s", name);
-		en->val=v;
-		en->constant=c;
-		return;
+
+static void sb_printf(StrBuf* b, const char* fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	sb_vprintf(b, fmt, ap);
+	va_end(ap);
+}
+
+typedef struct {
+	StrBuf* out;
+	int depth;
+	int tmp;
+	int nfuncs;
+	int nsyms;
+	int nmods;
+	StrBuf syms;
+	StrBuf decls;
+	StrBuf funcs;
+	NameTable names;
+} Emit;
+
+static void emit_line(Emit* E, const char* fmt, ...) {
+	for(int i=0; i<E->depth; i++) sb_printf(E->out, "\t");
+	va_list ap;
+	va_start(ap, fmt);
+	sb_vprintf(E->out, fmt, ap);
+	va_end(ap);
+	sb_printf(E->out, "\n");
+}
+
+static int emit_sym(Emit* E, const char* name) {
+	NameInfo* ni=names_get(&E->names, name);
+	if(!ni->sym) {
+		ni->sym = ++E->nsyms;
+		sb_printf(&E->syms, "static const char sym_%d[] = \"%s\";\n", E->nsyms, name);
 	}
-	en=(Entry*)malloc(sizeof(Entry));
-	en->name=strdup(name);
-	en->val=v;
-	en->constant=c;
-	en->next=e->head;
-	e->head=en;
+	return ni->sym;
 }
 
-static bool env_assign(Env* e, const char* name, Val v) {
-	Entry* en=env_find(e,name);
-	if(!en) return false;
-	if(en->constant) dief("cannot assign to const %s", name);
-	en->val=v;
-	return true;
+static int emit_expr(Emit* E, AST* a);
+
+static int emit_block(Emit* E, AST* a) {
+	int t=++E->tmp;
+	emit_line(E, "rt_val t%d = rt_null();", t);
+	for(size_t i=0; a && i<a->block.n; i++) {
+		int s=emit_expr(E, a->block.stmts[i]);
+		emit_line(E, "t%d = t%d;", t, s);
+	}
+	return t;
 }
 
-static void want_num(Val v, const char* op) {
-	if(v.tag!=V_NUM) dief("operator '%s' expects number", op);
+static int emit_if(Emit* E, AST* a, size_t i, int t) {
+	if(i==a->iff.n) {
+		if(a->iff.elseBody) {
+			int b=emit_expr(E, a->iff.elseBody);
+			emit_line(E, "t%d = t%d;", t, b);
+		}
+		return t;
+	}
+	int c=emit_expr(E, a->iff.conds[i]);
+	emit_line(E, "rt_want_bool(t%d, \"if/elif\");", c);
+	emit_line(E, "if(t%d.as.b) {", c);
+	E->depth++;
+	int b=emit_expr(E, a->iff.bodies[i]);
+	emit_line(E, "t%d = t%d;", t, b);
+	E->depth--;
+	if(i+1<a->iff.n || a->iff.elseBody) {
+		emit_line(E, "} else {");
+		E->depth++;
+		emit_if(E, a, i+1, t);
+		E->depth--;
+	}
+	emit_line(E, "}");
+	return t;
 }
 
-static void want_bool(Val v, const char* op) {
-	if(v.tag!=V_BOOL) dief("operator '%s' expects boolean", op);
+static int emit_func(Emit* E, AST* a) {
+	if(a->fn.gen) die("emit-c: generators are not supported");
+	int k=++E->nfuncs;
+	sb_printf(&E->decls, "static rt_val fn_%d(rt_env* env);\n", k);
+	sb_printf(&E->decls, "static const char* const params_%d[] = {", k);
+	for(size_t i=0; i<a->fn.nparams; i++) sb_printf(&E->decls, "%ssym_%d", i? ", " : " ", emit_sym(E, a->fn.params[i]->id.name));
+	sb_printf(&E->decls, " %s};\n", a->fn.nparams? "" : "NULL ");
+	StrBuf body= {0};
+	StrBuf* saved=E->out;
+	int depth=E->depth;
+	E->out=&body;
+	E->depth=1;
+	sb_printf(&body, "static rt_val fn_%d(rt_env* env) {\n", k);
+	int r=emit_expr(E, a->fn.body);
+	emit_line(E, "return t%d;", r);
+	sb_printf(&body, "}\n\n");
+	sb_printf(&E->funcs, "%s", body.s);
+	free(body.s);
+	E->out=saved;
+	E->depth=depth;
+	return k;
 }
 
-static Val eval(AST* a, Env* env);
-static Val eval_block(AST* a, Env* env) {
-	if(!a || !a->block.expr) return VNull();
-	AST* s=a->block.expr;
-	Val last = VNull();
-	switch(s->tag) {
-		case A_SEQ:
-		last = eval(s->seq.left, env);
-		return eval(s->seq.right, env);
-	default:
-		return eval(s, env);
+static const char* emit_binop(BOp op, int* kind, int* code) {
+	static const char* names[] = {
+		[B_ADD]="+", [B_SUB]="-", [B_MUL]="*", [B_DIV]="/", [B_MOD]="%",
+		[B_LT]="<", [B_LE]="<=", [B_GT]=">", [B_GE]=">=", [B_EQ]="==", [B_NE]="!=",
+		[B_AND]="&&", [B_OR]="||",
+	};
+	if(op<=B_MOD) {
+		*kind=0;
+		*code=(int)op-B_ADD;
+	} else if(op<=B_GE) {
+		*kind=1;
+		*code=(int)op-B_LT;
+	} else {
+		*kind=2;
+		*code= op==B_NE;
 	}
+	return names[op];
 }
 
-static Val eval(AST* a, Env* env) {
-	if(!a) return VNull();
+static int emit_expr(Emit* E, AST* a) {
+	int t;
+	if(!a) {
+		t=++E->tmp;
+		emit_line(E, "rt_val t%d = rt_null();", t);
+		return t;
+	}
 	switch(a->tag) {
 	case A_NUM:
-		return VNum(a->num);
+		t=++E->tmp;
+		emit_line(E, "rt_val t%d = rt_num(%d);", t, a->num);
+		return t;
 	case A_BOOL:
-		return VBool(a->boolean);
-	case A_ID: {
-		Entry* en=env_find(env, a->id.name);
-		if(!en) dief("undefined variable %s", a->id.name);
-		return en->val;
-	}
-	case A_LET: {
-		Val v = eval(a->var_.expr, env);
-		env_define(env, a->var_.id->id.name, v, a->var_.constant);
-		return v;
-	}
-	case A_ASSIGN: {
-		Val v = eval(a->asn.expr, env);
-		if(!env_assign(env, a->asn.id->id.name, v))
-			dief("assign to undefined variable %s", a->asn.id->id.name);
-		return v;
-	}
+		t=++E->tmp;
+		emit_line(E, "rt_val t%d = rt_bool(%s);", t, a->boolean? "true" : "false");
+		return t;
+	case A_ID:
+		t=++E->tmp;
+		emit_line(E, "rt_val t%d = rt_get(env, sym_%d);", t, emit_sym(E, a->id.name));
+		return t;
+	case A_LET:
+		t=emit_expr(E, a->var_.expr);
+		emit_line(E, "rt_define(env, sym_%d, t%d, %s);", emit_sym(E, a->var_.id->id.name), t, a->var_.constant? "true" : "false");
+		return t;
+	case A_ASSIGN:
+		t=emit_expr(E, a->asn.expr);
+		emit_line(E, "rt_assign(env, sym_%d, t%d);", emit_sym(E, a->asn.id->id.name), t);
+		return t;
 	case A_UN: {
-		Val v=eval(a->un.expr, env);
-		if(a->un.op==U_NEG) {
-			want_num(v,"-");
-			return VNum(-v.as.i);
-		} else {
-			want_bool(v,"!");
-			return VBool(!v.as.b);
-		}
+		int v=emit_expr(E, a->un.expr);
+		t=++E->tmp;
+		emit_line(E, "rt_val t%d = %s(t%d);", t, a->un.op==U_NEG? "rt_neg" : "rt_not", v);
+		return t;
 	}
 	case A_BIN: {
-		Val L=eval(a->bin.left, env);
-		if(a->bin.op==B_AND) {
-			want_bool(L,"&&");
-			if(!L.as.b) return VBool(false);
-			Val R=eval(a->bin.right, env);
-			want_bool(R,"&&");
-			return VBool(L.as.b && R.as.b);
-		}
-		if(a->bin.op==B_OR) {
-			want_bool(L,"||");
-			if(L.as.b) return VBool(true);
-			Val R=eval(a->bin.right, env);
-			want_bool(R,"||");
-			return VBool(L.as.b || R.as.b);
-		}
-		Val R=eval(a->bin.right, env);
-		switch(a->bin.op) {
-		case B_ADD:
-			want_num(L,"+");
-			want_num(R,"+");
-			return VNum(L.as.i + R.as.i);
-		case B_SUB:
-			want_num(L,"-");
-			want_num(R,"-");
-			return VNum(L.as.i - R.as.i);
-		case B_MUL:
-			want_num(L,"*");
-			want_num(R,"*");
-			return VNum(L.as.i * R.as.i);
-		case B_DIV:
-			want_num(L,"/");
-			want_num(R,"/");
-			if(R.as.i==0) die("division by zero");
-			return VNum(L.as.i / R.as.i);
-		case B_MOD:
-			want_num(L,"%");
-			want_num(R,"%");
-			if(R.as.i==0) die("modulus by zero");
-			return VNum(L.as.i % R.as.i);
-		case B_LT:
-			want_num(L,"<");
-			want_num(R,"<");
-			return VBool(L.as.i <  R.as.i);
-		case B_LE:
-			want_num(L,"<=");
-			want_num(R,"<=");
-			return VBool(L.as.i <= R.as.i);
-		case B_GT:
-			want_num(L,">");
-			want_num(R,">");
-			return VBool(L.as.i >  R.as.i);
-		case B_GE:
-			want_num(L,">=");
-			want_num(R,">=");
-			return VBool(L.as.i >= R.as.i);
-		case B_EQ:
-			if(L.tag!=R.tag) return VBool(false);
-			if(L.tag==V_NUM) return VBool(L.as.i==R.as.i);
-			if(L.tag==V_BOOL) return VBool(L.as.b==R.as.b);
-			return VBool(false);
-		case B_NE:
-			if(L.tag!=R.tag) return VBool(true);
-			if(L.tag==V_NUM) return VBool(L.as.i!=R.as.i);
-			if(L.tag==V_BOOL) return VBool(L.as.b!=R.as.b);
-			return VBool(true);
-		default:
-			die("internal bin op");
+		int l=emit_expr(E, a->bin.left);
+		t=++E->tmp;
+		if(a->bin.op==B_AND || a->bin.op==B_OR) {
+			const char* op = a->bin.op==B_AND? "&&" : "||";
+			emit_line(E, "rt_val t%d;", t);
+			emit_line(E, "rt_want_bool(t%d, \"%s\");", l, op);
+			emit_line(E, "if(%st%d.as.b) {", a->bin.op==B_AND? "!" : "", l);
+			emit_line(E, "\tt%d = rt_bool(%s);", t, a->bin.op==B_AND? "false" : "true");
+			emit_line(E, "} else {");
+			E->depth++;
+			int r=emit_expr(E, a->bin.right);
+			emit_line(E, "rt_want_bool(t%d, \"%s\");", r, op);
+			emit_line(E, "t%d = rt_bool(t%d.as.b);", t, r);
+			E->depth--;
+			emit_line(E, "}");
+			return t;
 		}
+		int r=emit_expr(E, a->bin.right);
+		int kind, code;
+		emit_binop(a->bin.op, &kind, &code);
+		if(kind==0) emit_line(E, "rt_val t%d = rt_arith(%d, t%d, t%d);", t, code, l, r);
+		else if(kind==1) emit_line(E, "rt_val t%d = rt_cmp(%d, t%d, t%d);", t, code, l, r);
+		else emit_line(E, "rt_val t%d = rt_eq(t%d, t%d, %s);", t, l, r, code? "true" : "false");
+		return t;
 	}
-	case A_SEQ:
-		(void)eval(a->seq.left, env);
-		return eval(a->seq.right, env);
 	case A_BLOCK:
-		return eval_block(a, env);
-	case A_IFELSE: {
-		for(size_t i=0; i<a->iff.n; i++) {
-			Val v=eval(a->iff.conds[i], env);
-			want_bool(v,"if/elif");
-			if(v.as.b) return eval(a->iff.bodies[i], env);
-		}
-		if(a->iff.elseBody) return eval(a->iff.elseBody, env);
-		return VNull();
-	}
+		return emit_block(E, a);
+	case A_IFELSE:
+		t=++E->tmp;
+		emit_line(E, "rt_val t%d = rt_null();", t);
+		emit_line(E, "{");
+		E->depth++;
+		emit_if(E, a, 0, t);
+		E->depth--;
+		emit_line(E, "}");
+		return t;
 	case A_WHILE: {
-		Val last=VNull();
-		for(;;) {
-			Val c=eval(a->wh.cond, env);
-			want_bool(c,"while");
-			if(!c.as.b) break;
-			last=eval(a->wh.body, env);
+		t=++E->tmp;
+		emit_line(E, "rt_val t%d = rt_null();", t);
+		emit_line(E, "for(;;) {");
+		E->depth++;
+		int c=emit_expr(E, a->wh.cond);
+		emit_line(E, "rt_want_bool(t%d, \"while\");", c);
+		emit_line(E, "if(!t%d.as.b) break;", c);
+		int b=emit_expr(E, a->wh.body);
+		emit_line(E, "t%d = t%d;", t, b);
+		E->depth--;
+		emit_line(E, "}");
+		return t;
+	}
+	case A_IMPORT: {
+		/* every import site carries the body, guarded so that it runs once */
+		Module* m=a->imp.mod;
+		if(!m->emit_id) {
+			m->emit_id=++E->nmods;
+			sb_printf(&E->decls, "static bool mod_%d;\n", m->emit_id);
 		}
-		return last;
+		t=++E->tmp;
+		emit_line(E, "rt_val t%d = rt_null();", t);
+		emit_line(E, "if(!mod_%d) {", m->emit_id);
+		E->depth++;
+		emit_line(E, "mod_%d = true;", m->emit_id);
+		emit_block(E, m->body);
+		E->depth--;
+		emit_line(E, "}");
+		return t;
+	}
+	case A_FOR: {
+		t=++E->tmp;
+		int sym=emit_sym(E, a->fr.id->id.name);
+		emit_line(E, "rt_val t%d = rt_null();", t);
+		emit_line(E, "{");
+		E->depth++;
+		int from=emit_expr(E, a->fr.from);
+		emit_line(E, "rt_want_num(t%d, \"for\");", from);
+		int to=emit_expr(E, a->fr.to);
+		emit_line(E, "rt_want_num(t%d, \"for\");", to);
+		emit_line(E, "rt_define(env, sym_%d, t%d, false);", sym, from);
+		emit_line(E, "rt_entry* s%d = rt_find(env, sym_%d);", t, sym);
+		emit_line(E, "int i%d = t%d.as.i;", t, from);
+		emit_line(E, "for(; i%d<t%d.as.i; i%d++) {", t, to, t);
+		E->depth++;
+		emit_line(E, "s%d->val = rt_num(i%d);", t, t);
+		int b=emit_expr(E, a->fr.body);
+		emit_line(E, "t%d = t%d;", t, b);
+		E->depth--;
+		emit_line(E, "}");
+		emit_line(E, "s%d->val = rt_num(i%d);", t, t);
+		E->depth--;
+		emit_line(E, "}");
+		return t;
+	}
+	case A_FUNC_LIT: {
+		int k=emit_func(E, a);
+		t=++E->tmp;
+		emit_line(E, "rt_val t%d = rt_func(fn_%d, params_%d, %zu, %s, env);", t, k, k, a->fn.nparams, a->fn.noescape? "true" : "false");
+		return t;
 	}
-	case A_FUNC_LIT:
-		return VFunc((AST*)a, env);
 	case A_CALL: {
-		Val cal = eval(a->call.callee, env);
-		if(cal.tag!=V_FUNC) die("attempt to call non-function");
-		Closure* cl=cal.as.fn;
-		AST* fn=cl->fun;
-		size_t nparams=fn->fn.nparams;
-		if(a->call.nargs!=nparams) dief("arity mismatch: expected %zu args, got %zu", nparams, a->call.nargs);
-		Env* callenv = env_new(cl->env);
-		for(size_t i=0; i<nparams; i++) {
-			AST* pid = fn->fn.params[i];
-			Val arg = eval(a->call.args[i], env);
-			env_define(callenv, pid->id.name, arg, false);
+		int c=emit_expr(E, a->call.callee);
+		t=++E->tmp;
+		emit_line(E, "rt_closure* c%d = rt_callee(t%d, %zu);", t, c, a->call.nargs);
+		emit_line(E, "rt_mark m%d = rt_frame_mark();", t);
+		emit_line(E, "rt_env* e%d = rt_call_env(c%d);", t, t);
+		for(size_t i=0; i<a->call.nargs; i++) {
+			int v=emit_expr(E, a->call.args[i]);
+			emit_line(E, "rt_define(e%d, c%d->params[%zu], t%d, false);", t, t, i, v);
 		}
-		return eval(fn->fn.body, callenv);
+		emit_line(E, "rt_val t%d = c%d->code(e%d);", t, t, t);
+		emit_line(E, "rt_frame_release(m%d);", t);
+		return t;
 	}
 	case A_BUILTIN: {
-		switch(a->builtin.bi) {
-		case BUILTIN_OUTN: {
-			if(a->builtin.nargs!=1) die("outn expects 1 argument");
-			Val v=eval(a->builtin.args[0], env);
-			switch(v.tag) {
-			case V_NUM:
-				printf("%d\n", v.as.i);
-				break;
-			case V_BOOL:
-				printf("%s\n", v.as.b? "true":"false");
-				break;
-			case V_FUNC:
-				printf("<function>\n");
-				break;
-			default:
-				printf("null\n");
-				break;
+		if(a->builtin.bi==BUILTIN_NEXT || a->builtin.bi==BUILTIN_DONE) die("emit-c: generators are not supported");
+		if(a->builtin.bi!=BUILTIN_OUTN) die("emit-c: maps are not supported");
+		int v=emit_expr(E, a->builtin.args[0]);
+		t=++E->tmp;
+		emit_line(E, "rt_val t%d = rt_outn(t%d);", t, v);
+		return t;
+	}
+	default:
+		dief("emit-c: unsupported node '%s'", atag_names[a->tag]);
+	}
+	return 0;
+}
+
+static void emit_program(AST* prog, FILE* f) {
+	Emit E= {0};
+	StrBuf body= {0};
+	E.out=&body;
+	E.depth=1;
+	emit_line(&E, "rt_env* env = rt_env_new(NULL);");
+	int r=emit_expr(&E, prog);
+	emit_line(&E, "(void)t%d;", r);
+	emit_line(&E, "return 0;");
+	fprintf(f, "/* generated by slug --emit-c */\n#include \"slug_rt.h\"\n\n");
+	if(E.syms.s) fprintf(f, "%s\n", E.syms.s);
+	if(E.decls.s) fprintf(f, "%s\n", E.decls.s);
+	if(E.funcs.s) fputs(E.funcs.s, f);
+	fprintf(f, "int main(void) {\n%s}\n", body.s);
+	free(body.s);
+	free(E.syms.s);
+	free(E.decls.s);
+	free(E.funcs.s);
+	names_free(&E.names);
+}
+
+/*
+ * Heap images. --snapshot runs a prelude and writes everything reachable
+ * from the global Env (entries, closures, the Envs they hold and the ASTs
+ * and names those point at) to a file. Pointers are stored as offsets
+ * into the heap section and listed in a relocation table, so --image
+ * only maps the file privately and adds the mapping address to each
+ * listed word; the job script then runs in the restored global Env. The
+ * header carries a format version and a fingerprint of the struct
+ * layouts, and an image written by an incompatible binary is refused.
+ * Parsed modules are cached on disk in the same format.
+ */
+#define IMAGE_MAGIC "SLUGIMG"
+#define MODULE_MAGIC "SLUGMOD"
+#define IMAGE_VERSION 3
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t layout;
+	uint64_t size; /* bytes in the heap section */
+	uint64_t nrelocs;
+	uint64_t root; /* the global Env, or a module's body */
+	uint64_t list; /* names the prelude mentions, or a module's imports */
+	uint64_t nlist;
+	uint64_t source; /* a module's source text, which a cached copy must match, or 0 */
+} ImageHeader;
+
+typedef enum { S_AST, S_ASTV, S_STR, S_ENV, S_ENTRY, S_CELLS, S_CLOSURE, S_CAPS, S_NAMES, S_MAP, S_MAPMEM } SnapKind;
+
+typedef struct {
+	SnapKind kind;
+	const void* p;
+	size_t off, n;
+} SnapWork;
+
+typedef struct {
+	char* buf;
+	size_t len, cap;
+	uint64_t* relocs;
+	size_t nrelocs, rcap;
+	const void** keys;
+	size_t* offs;
+	size_t mcap, mn;
+	SnapWork* work;
+	size_t nwork, wcap;
+} Snap;
+
+static uint32_t image_layout(void) {
+	const size_t v[] = {
+		sizeof(void*), sizeof(AST), sizeof(Val), sizeof(Env), sizeof(Entry), sizeof(Closure), sizeof(Capture),
+		offsetof(AST, fn.caps), offsetof(Env, cells), offsetof(Entry, val), A_NTAGS, V_MAP,
+		sizeof(Map), sizeof(MapSlot), BUILTIN_SIZE,
+	};
+	uint64_t h=1469598103934665603ull;
+	for(size_t i=0; i<sizeof(v); i++) {
+		h^=((const unsigned char*)v)[i];
+		h*=1099511628211ull;
+	}
+	return (uint32_t)(h^h>>32);
+}
+
+static size_t snap_reserve(Snap* S, size_t n) {
+	n=(n+15)&~(size_t)15;
+	if(S->len+n>S->cap) {
+		size_t cap=S->cap? S->cap : 1<<16;
+		while(S->len+n>cap) cap*=2;
+		S->buf=(char*)realloc(S->buf, cap);
+		if(!S->buf) die("out of memory");
+		memset(S->buf+S->cap, 0, cap-S->cap);
+		S->cap=cap;
+	}
+	size_t off=S->len;
+	S->len+=n;
+	return off;
+}
+
+static size_t* snap_slot(Snap* S, const void* p) {
+	if((S->mn+1)*2>S->mcap) {
+		Snap g= {.mcap=S->mcap? S->mcap*2 : 1024};
+		g.keys=(const void**)calloc(g.mcap, sizeof(void*));
+		g.offs=(size_t*)calloc(g.mcap, sizeof(size_t));
+		for(size_t i=0; i<S->mcap; i++) {
+			if(!S->keys[i]) continue;
+			size_t j=((uintptr_t)S->keys[i]>>4)*0x9E3779B97F4A7C15ull&(g.mcap-1);
+			while(g.keys[j]) j=(j+1)&(g.mcap-1);
+			g.keys[j]=S->keys[i];
+			g.offs[j]=S->offs[i];
+		}
+		free(S->keys);
+		free(S->offs);
+		S->keys=g.keys;
+		S->offs=g.offs;
+		S->mcap=g.mcap;
+	}
+	size_t j=((uintptr_t)p>>4)*0x9E3779B97F4A7C15ull&(S->mcap-1);
+	while(S->keys[j] && S->keys[j]!=p) j=(j+1)&(S->mcap-1);
+	if(!S->keys[j]) {
+		S->keys[j]=p;
+		S->offs[j]=0;
+		S->mn++;
+	}
+	return &S->offs[j];
+}
+
+/* copies the object at p once and queues its pointer fields; 0 stands for NULL */
+static size_t snap_obj(Snap* S, SnapKind kind, const void* p, size_t n) {
+	if(!p) return 0;
+	size_t* slot=snap_slot(S, p);
+	if(*slot) return *slot;
+	size_t size;
+	switch(kind) {
+	case S_AST:
+		size=sizeof(AST);
+		break;
+	case S_STR:
+		size=strlen((const char*)p)+1;
+		break;
+	case S_ENV:
+		if(((const Env*)p)->stack) die("snapshot: cannot save a frame");
+		size=sizeof(Env);
+		break;
+	case S_ENTRY:
+		size=sizeof(Entry);
+		break;
+	case S_CLOSURE:
+		size=sizeof(Closure);
+		break;
+	case S_CAPS:
+		size=n*sizeof(Capture);
+		break;
+	case S_MAP:
+		size=sizeof(Map);
+		break;
+	case S_MAPMEM:
+		size=n+n*sizeof(MapSlot);
+		break;
+	default:
+		size=n*sizeof(void*);
+		break;
+	}
+	size_t off=snap_reserve(S, size? size : 1);
+	memcpy(S->buf+off, p, size);
+	*snap_slot(S, p)=off;
+	if(S->nwork==S->wcap) {
+		S->wcap=S->wcap? S->wcap*2 : 256;
+		S->work=(SnapWork*)realloc(S->work, S->wcap*sizeof(SnapWork));
+	}
+	S->work[S->nwork++]=(SnapWork) {
+		.kind=kind, .p=p, .off=off, .n=n
+	};
+	return off;
+}
+
+/* stores the offset of p's copy in the pointer field at 'at' */
+static void snap_ref(Snap* S, size_t at, SnapKind kind, const void* p, size_t n) {
+	uint64_t off=snap_obj(S, kind, p, n);
+	memcpy(S->buf+at, &off, sizeof(off));
+	if(!off) return;
+	if(S->nrelocs==S->rcap) {
+		S->rcap=S->rcap? S->rcap*2 : 1024;
+		S->relocs=(uint64_t*)realloc(S->relocs, S->rcap*sizeof(uint64_t));
+	}
+	S->relocs[S->nrelocs++]=at;
+}
+
+static void snap_val(Snap* S, size_t at, const Val* v) {
+	if(v->tag==V_GEN) die("snapshot: cannot save a generator");
+	if(v->tag==V_FUNC) snap_ref(S, at+offsetof(Val, as.fn), S_CLOSURE, v->as.fn, 0);
+	if(v->tag==V_MAP) snap_ref(S, at+offsetof(Val, as.map), S_MAP, v->as.map, 0);
+}
+
+#define SNAP_AST(field, kind, p, n) snap_ref(S, w.off+offsetof(AST, field), kind, p, n)
+
+static void snap_ast(Snap* S, SnapWork w) {
+	const AST* a=(const AST*)w.p;
+	switch(a->tag) {
+	case A_ID:
+		SNAP_AST(id.name, S_STR, a->id.name, 0);
+		break;
+	case A_LET:
+		SNAP_AST(var_.id, S_AST, a->var_.id, 0);
+		SNAP_AST(var_.expr, S_AST, a->var_.expr, 0);
+		break;
+	case A_ASSIGN:
+		SNAP_AST(asn.id, S_AST, a->asn.id, 0);
+		SNAP_AST(asn.expr, S_AST, a->asn.expr, 0);
+		break;
+	case A_BIN:
+		SNAP_AST(bin.left, S_AST, a->bin.left, 0);
+		SNAP_AST(bin.right, S_AST, a->bin.right, 0);
+		break;
+	case A_UN:
+		SNAP_AST(un.expr, S_AST, a->un.expr, 0);
+		break;
+	case A_BLOCK:
+		((AST*)(S->buf+w.off))->block.cap=a->block.n;
+		SNAP_AST(block.stmts, S_ASTV, a->block.stmts, a->block.n);
+		break;
+	case A_IFELSE:
+		SNAP_AST(iff.conds, S_ASTV, a->iff.conds, a->iff.n);
+		SNAP_AST(iff.bodies, S_ASTV, a->iff.bodies, a->iff.n);
+		SNAP_AST(iff.elseBody, S_AST, a->iff.elseBody, 0);
+		break;
+	case A_WHILE:
+		SNAP_AST(wh.cond, S_AST, a->wh.cond, 0);
+		SNAP_AST(wh.body, S_AST, a->wh.body, 0);
+		break;
+	case A_FOR:
+		SNAP_AST(fr.id, S_AST, a->fr.id, 0);
+		SNAP_AST(fr.from, S_AST, a->fr.from, 0);
+		SNAP_AST(fr.to, S_AST, a->fr.to, 0);
+		SNAP_AST(fr.body, S_AST, a->fr.body, 0);
+		break;
+	case A_FUNC_LIT:
+		SNAP_AST(fn.name, S_STR, a->fn.name, 0);
+		SNAP_AST(fn.params, S_ASTV, a->fn.params, a->fn.nparams);
+		SNAP_AST(fn.body, S_AST, a->fn.body, 0);
+		SNAP_AST(fn.caps, S_CAPS, a->fn.caps, a->fn.ncaps);
+		break;
+	case A_CALL:
+		SNAP_AST(call.callee, S_AST, a->call.callee, 0);
+		SNAP_AST(call.args, S_ASTV, a->call.args, a->call.nargs);
+		break;
+	case A_BUILTIN:
+		SNAP_AST(builtin.args, S_ASTV, a->builtin.args, a->builtin.nargs);
+		break;
+	case A_INLINE:
+		SNAP_AST(inl.body, S_AST, a->inl.body, 0);
+		SNAP_AST(inl.args, S_ASTV, a->inl.args, a->inl.nargs);
+		SNAP_AST(inl.name, S_STR, a->inl.name, 0);
+		break;
+	case A_PARAM_REF:
+		SNAP_AST(pref.name, S_STR, a->pref.name, 0);
+		break;
+	case A_YIELD:
+		SNAP_AST(yld.expr, S_AST, a->yld.expr, 0);
+		break;
+	case A_IMPORT:
+		((AST*)(S->buf+w.off))->imp.mod=NULL;
+		SNAP_AST(imp.path, S_STR, a->imp.path, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+static void snap_drain(Snap* S) {
+	while(S->nwork) {
+		SnapWork w=S->work[--S->nwork];
+		switch(w.kind) {
+		case S_AST:
+			snap_ast(S, w);
+			break;
+		case S_ENV: {
+			const Env* e=(const Env*)w.p;
+			snap_ref(S, w.off+offsetof(Env, head), S_ENTRY, e->head, 0);
+			snap_ref(S, w.off+offsetof(Env, parent), S_ENV, e->parent, 0);
+			snap_ref(S, w.off+offsetof(Env, cells), S_CELLS, e->cells, e->ncells);
+			break;
+		}
+		case S_ENTRY: {
+			const Entry* en=(const Entry*)w.p;
+			snap_ref(S, w.off+offsetof(Entry, name), S_STR, en->name, 0);
+			snap_val(S, w.off+offsetof(Entry, val), &en->val);
+			snap_ref(S, w.off+offsetof(Entry, next), S_ENTRY, en->next, 0);
+			break;
+		}
+		case S_CLOSURE: {
+			const Closure* c=(const Closure*)w.p;
+			snap_ref(S, w.off+offsetof(Closure, fun), S_AST, c->fun, 0);
+			snap_ref(S, w.off+offsetof(Closure, env), S_ENV, c->env, 0);
+			break;
+		}
+		case S_MAP: {
+			const Map* m=(const Map*)w.p;
+			/* the loaded table lives in the image, so growing it must not free it */
+			((Map*)(S->buf+w.off))->owned=false;
+			snap_ref(S, w.off+offsetof(Map, ctrl), S_MAPMEM, m->ctrl, m->cap);
+			break;
+		}
+		case S_MAPMEM: {
+			const int8_t* ctrl=(const int8_t*)w.p;
+			const MapSlot* s=(const MapSlot*)(ctrl+w.n);
+			for(size_t i=0; i<w.n; i++) {
+				if(ctrl[i]>=0) snap_val(S, w.off+w.n+i*sizeof(MapSlot)+offsetof(MapSlot, val), &s[i].val);
 			}
-			return VBool(true);
+			break;
 		}
+		case S_CAPS:
+			for(size_t i=0; i<w.n; i++) snap_ref(S, w.off+i*sizeof(Capture)+offsetof(Capture, name), S_STR, ((const Capture*)w.p)[i].name, 0);
+			break;
+		case S_ASTV:
+		case S_CELLS:
+		case S_NAMES: {
+			SnapKind k = w.kind==S_ASTV? S_AST : w.kind==S_CELLS? S_ENTRY : S_STR;
+			for(size_t i=0; i<w.n; i++) snap_ref(S, w.off+i*sizeof(void*), k, ((void* const*)w.p)[i], 0);
+			break;
+		}
+		default:
+			break;
 		}
-		die("unknown builtin");
 	}
-	default:
-		die("not implemented ast node");
+}
+
+static bool image_save(const char* path, const char* magic, SnapKind kind, const void* root, SnapKind lkind, const void* list, size_t n, const char* source) {
+	Snap S= {0};
+	snap_reserve(&S, 1); /* keeps offset 0 free to mean NULL */
+	size_t source_off=snap_obj(&S, S_STR, source, 0);
+	size_t list_off=snap_obj(&S, lkind, list, n);
+	size_t root_off=snap_obj(&S, kind, root, 0);
+	snap_drain(&S);
+	ImageHeader h= {
+		.version=IMAGE_VERSION, .layout=image_layout(), .size=S.len, .nrelocs=S.nrelocs,
+		.root=root_off, .list=list_off, .nlist=n, .source=source_off,
+	};
+	memcpy(h.magic, magic, sizeof(h.magic));
+	FILE* f=fopen(path, "wb");
+	bool ok = f && fwrite(&h, sizeof(h), 1, f)==1 && fwrite(S.buf, 1, S.len, f)==S.len &&
+	          fwrite(S.relocs, sizeof(uint64_t), S.nrelocs, f)==S.nrelocs;
+	if(f && fclose(f)!=0) ok=false;
+	free(S.buf);
+	free(S.relocs);
+	free(S.keys);
+	free(S.offs);
+	free(S.work);
+	return ok;
+}
+
+/* maps and relocates an image; on failure returns a message with a %s for the path */
+static const char* image_map(const char* path, const char* magic, const ImageHeader** hp, char** basep) {
+	int fd=open(path, O_RDONLY);
+	struct stat st;
+	if(fd<0 || fstat(fd, &st)!=0) {
+		if(fd>=0) close(fd);
+		return "could not read image: %s";
 	}
-	return VNull();
+	if((size_t)st.st_size<sizeof(ImageHeader)) {
+		close(fd);
+		return "%s is not a slug image";
+	}
+	char* map=(char*)mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map==MAP_FAILED) return "could not map image: %s";
+	const ImageHeader* h=(const ImageHeader*)map;
+	const char* err=NULL;
+	if(memcmp(h->magic, magic, sizeof(h->magic))!=0) err="%s is not a slug image";
+	else if(h->version!=IMAGE_VERSION || h->layout!=image_layout()) err="%s was written by an incompatible slug build";
+	else if(h->nrelocs>(uint64_t)st.st_size/sizeof(uint64_t) || sizeof(ImageHeader)+h->size+h->nrelocs*sizeof(uint64_t)!=(uint64_t)st.st_size ||
+	        h->root>=h->size || h->nlist>h->size/sizeof(void*) || h->list+h->nlist*sizeof(void*)>h->size ||
+	        (h->source && (h->source>=h->size || !memchr(map+sizeof(ImageHeader)+h->source, '\0', h->size-h->source)))) err="image %s is corrupt";
+	char* base=map+sizeof(ImageHeader);
+	const uint64_t* rel=(const uint64_t*)(base+h->size);
+	for(uint64_t i=0; !err && i<h->nrelocs; i++) {
+		uintptr_t* w=(uintptr_t*)(base+rel[i]);
+		if(rel[i]%sizeof(uintptr_t) || rel[i]+sizeof(uintptr_t)>h->size || *w>=h->size) err="image %s is corrupt";
+		else *w+=(uintptr_t)base;
+	}
+	if(err) {
+		munmap(map, (size_t)st.st_size);
+		return err;
+	}
+	*hp=h;
+	*basep=base;
+	return NULL;
+}
+
+static void image_write(const char* path, Env* global, AST* prog) {
+	NameTable t= {0};
+	names_scan(prog, &t, true);
+	for(size_t i=0; i<image_nnames; i++) names_get(&t, image_names[i]);
+	const char** names=(const char**)malloc((t.n? t.n : 1)*sizeof(char*));
+	size_t n=0;
+	for(size_t i=0; i<t.cap; i++) if(t.slots[i].name) names[n++]=t.slots[i].name;
+	names_free(&t);
+	if(!image_save(path, IMAGE_MAGIC, S_ENV, global, S_NAMES, names, n, NULL)) dief("could not write image: %s", path);
+	free(names);
+}
+
+static Env* image_load(const char* path) {
+	const ImageHeader* h;
+	char* base;
+	const char* err=image_map(path, IMAGE_MAGIC, &h, &base);
+	if(err) dief(err, path);
+	image_names=(const char**)(base+h->list);
+	image_nnames=h->nlist;
+	return (Env*)(base+h->root);
 }
 
 static char* fslurp(const char* path) {
@@ -1109,12 +3678,422 @@ static char* fslurp(const char* path) {
 	return s;
 }
 
+/*
+ * Modules. An import resolves its path against the directory of the file
+ * containing it, and modules are kept by canonical path, so every import
+ * of one file shares a single parse and a single evaluation. Parsed
+ * bodies are also cached on disk under $SLUG_CACHE (by default
+ * ~/.cache/slug), named by a hash of the source text, so other processes
+ * importing the same library map the cached tree instead of parsing it.
+ * Imports inside a cached body are resolved again when it is loaded,
+ * against the directory of the module being loaded.
+ */
+static const char* module_cache_dir(void) {
+	static bool init=false;
+	static char* dir=NULL;
+	if(init) return dir;
+	init=true;
+	const char* env=getenv("SLUG_CACHE");
+	if(env) {
+		if(!*env) return NULL;
+		dir=strdup(env);
+	} else {
+		const char* home=getenv("HOME");
+		if(!home || !*home) return NULL;
+		size_t n=strlen(home)+sizeof("/.cache/slug");
+		dir=(char*)malloc(n);
+		snprintf(dir, n, "%s/.cache", home);
+		mkdir(dir, 0755);
+		snprintf(dir, n, "%s/.cache/slug", home);
+	}
+	mkdir(dir, 0755);
+	return dir;
+}
+
+static char* module_cache_path(uint64_t hash) {
+	const char* dir=module_cache_dir();
+	if(!dir) return NULL;
+	size_t n=strlen(dir)+32;
+	char* path=(char*)malloc(n);
+	snprintf(path, n, "%s/%016llx.slm", dir, (unsigned long long)hash);
+	return path;
+}
+
+static char* path_dir(const char* path) {
+	const char* slash=strrchr(path, '/');
+	if(!slash) return NULL;
+	size_t n = slash==path? 1 : (size_t)(slash-path);
+	char* d=(char*)malloc(n+1);
+	memcpy(d, path, n);
+	d[n]='\0';
+	return d;
+}
+
+/*
+ * The builtin names a source binds with a top-level var/const, or that
+ * global already holds. Declarations inside a function body, the braces
+ * opened right after '=>', only shadow within that function; the parser
+ * scopes those like parameters.
+ */
+static unsigned builtins_shadowed(const TokVec* tv, Env* global) {
+	unsigned m=0;
+	size_t depth=0, body=SIZE_MAX; /* brace depth, and that of the outermost function body */
+	for(size_t i=0; i+1<tv->n; i++) {
+		Tok t=tv->data[i].t;
+		if(t==T_LBRACE) {
+			if(body==SIZE_MAX && i && tv->data[i-1].t==T_ARROW) body=depth;
+			depth++;
+		} else if(t==T_RBRACE && depth) {
+			if(--depth==body) body=SIZE_MAX;
+		} else if((t==T_LET || t==T_CONST) && body==SIZE_MAX && tv->data[i+1].t==T_ID) {
+			m|=builtin_bit(tv->src+tv->data[i+1].off, tv->data[i+1].len);
+		}
+	}
+	if(global) {
+		for(size_t i=0; i<sizeof(builtin_names)/sizeof(builtin_names[0]); i++) {
+			if(env_find_lean(global, builtin_names[i].name)) m|=1u<<i;
+		}
+	}
+	return m;
+}
+
+/* the builtin names a module defines for its importer, including through its own imports */
+static unsigned module_shadowed(const AST* body) {
+	unsigned m=0;
+	if(body->tag!=A_BLOCK) return 0;
+	for(size_t i=0; i<body->block.n; i++) {
+		const AST* s=body->block.stmts[i];
+		if(s->tag==A_LET) m|=builtin_bit(s->var_.id->id.name, strlen(s->var_.id->id.name));
+		else if(s->tag==A_IMPORT) m|=s->imp.mod->shadowed;
+	}
+	return m;
+}
+
+/* registers the main script, so that an import of it is seen as circular */
+static Module* module_enter(const char* path) {
+	char* canon=realpath(path, NULL);
+	if(!canon) return NULL;
+	Module* m=(Module*)calloc(1, sizeof(Module));
+	m->path=canon;
+	m->loading=true;
+	m->next=modules;
+	modules=m;
+	return m;
+}
+
+static Module* module_import(const char* dir, const char* path) {
+	char* full;
+	if(dir && path[0]!='/') {
+		size_t n=strlen(dir)+strlen(path)+2;
+		full=(char*)malloc(n);
+		snprintf(full, n, "%s/%s", dir, path);
+	} else {
+		full=strdup(path);
+	}
+	char* canon=realpath(full, NULL);
+	free(full);
+	if(!canon) dief("cannot import %s: no such file", path);
+	for(Module* m=modules; m; m=m->next) {
+		if(strcmp(m->path, canon)!=0) continue;
+		free(canon);
+		if(m->loading) {
+			/* the modules still loading form the import chain, newest first */
+			StrBuf chain= {0};
+			sb_printf(&chain, "%s", m->path);
+			for(Module* o=modules; o!=m; o=o->next) {
+				if(!o->loading) continue;
+				StrBuf b= {0};
+				sb_printf(&b, "%s -> %s", o->path, chain.s);
+				free(chain.s);
+				chain=b;
+			}
+			dief("circular import: %s -> %s", m->path, chain.s);
+		}
+		return m;
+	}
+	double t=now_ms();
+	char* src=fslurp(canon);
+	if(!src) dief("cannot import %s: unreadable", path);
+	Module* m=(Module*)calloc(1, sizeof(Module));
+	m->path=canon;
+	m->hash=name_hash(src);
+	m->loading=true;
+	m->next=modules;
+	modules=m;
+	char* mdir=path_dir(canon);
+	char* cache=module_cache_path(m->hash);
+	const ImageHeader* h;
+	char* base;
+	const char* how="parsed";
+	if(cache && !image_map(cache, MODULE_MAGIC, &h, &base)) {
+		/* the name is only a 64-bit hash of the source, so the text itself decides */
+		if(h->source && strcmp(base+h->source, src)==0) {
+			m->body=(AST*)(base+h->root);
+			AST** imports=(AST**)(base+h->list);
+			for(size_t i=0; i<h->nlist; i++) imports[i]->imp.mod=module_import(mdir, imports[i]->imp.path);
+			how="loaded from cache";
+		} else {
+			munmap((void*)h, sizeof(ImageHeader)+h->size+h->nrelocs*sizeof(uint64_t));
+		}
+	}
+	if(!m->body) {
+		TokVec tv;
+		tokenize(src, &tv);
+		Parser P = { .toks=&tv, .i=0, .dir=mdir, .shadowed=builtins_shadowed(&tv, NULL) };
+		m->body=parse_program(&P);
+		capture_pass(m->body, NULL);
+		tv_free(&tv);
+		if(cache) {
+			/* written aside and renamed, so concurrent readers see a whole file or none */
+			size_t n=strlen(cache)+32;
+			char* tmp=(char*)malloc(n);
+			snprintf(tmp, n, "%s.%ld", cache, (long)getpid());
+			if(image_save(tmp, MODULE_MAGIC, S_AST, m->body, S_ASTV, P.imports, P.nimports, src)) rename(tmp, cache);
+			else unlink(tmp);
+			free(tmp);
+		}
+		free(P.imports);
+	}
+	m->shadowed=module_shadowed(m->body);
+	m->loading=false;
+	if(verbose) fprintf(stderr, "module %s: %s in %.3f ms\n", m->path, how, now_ms()-t);
+	free(cache);
+	free(mdir);
+	free(src);
+	return m;
+}
+
+/* forgets modules whose load was cut short by an error in the REPL */
+static void modules_abandon(void) {
+	for(Module** m=&modules; *m;) {
+		if((*m)->loading) *m=(*m)->next;
+		else m=&(*m)->next;
+	}
+}
+
+static const char* opt_value(int argc, char** argv, int* i, const char* name) {
+	size_t len=strlen(name);
+	if(strncmp(argv[*i], name, len)!=0) return NULL;
+	if(argv[*i][len]=='=') return argv[*i]+len+1;
+	if(argv[*i][len]!='\0') return NULL;
+	if(*i+1>=argc) {
+		fprintf(stderr,"option %s expects a value\n", name);
+		exit(EXIT_FAILURE);
+	}
+	return argv[++*i];
+}
+
+/* a count with an optional K, M or G suffix; values that do not fit in size_t are rejected */
+static unsigned long long parse_size(const char* s, const char* opt) {
+	char* end;
+	errno=0;
+	unsigned long long v=strtoull(s, &end, 10);
+	unsigned shift=0;
+	switch(*end) {
+	case 'k':
+	case 'K':
+		shift=10;
+		end++;
+		break;
+	case 'm':
+	case 'M':
+		shift=20;
+		end++;
+		break;
+	case 'g':
+	case 'G':
+		shift=30;
+		end++;
+		break;
+	}
+	if(end==s || *end!='\0' || *s=='-' || errno==ERANGE || v==0 || v>(SIZE_MAX>>shift)) {
+		fprintf(stderr,"invalid value for %s: %s\n", opt, s);
+		exit(EXIT_FAILURE);
+	}
+	return v<<shift;
+}
+
+/*
+ * An input is complete once its braces and parentheses balance and it
+ * ends in ';' or '}'. Everything is line based, so an 'elif' or 'else'
+ * has to stay on the line of the closing brace it follows.
+ */
+static bool input_complete(const char* s) {
+	long depth=0;
+	char last='\0';
+	for(; *s; s++) {
+		if(s[0]=='/' && s[1]=='/') {
+			while(*s && *s!='\n') s++;
+			if(!*s) break;
+			continue;
+		}
+		if(*s=='{' || *s=='(') depth++;
+		else if(*s=='}' || *s==')') depth--;
+		if(!(cclass[(unsigned char)*s]&C_SPACE)) last=*s;
+	}
+	return depth<=0 && (last==';' || last=='}');
+}
+
+/*
+ * Interactive mode. The global environment, and with it every function
+ * body that was already parsed and analysed, persists across inputs; only
+ * the newly submitted text is tokenized and parsed. An input is parsed
+ * whole before any of it runs, so a parse error leaves the state as it
+ * was. A runtime error abandons the rest of the input; statements before
+ * the failing one have already taken effect.
+ */
+static int repl(Env* global) {
+	bool tty=isatty(STDIN_FILENO);
+	cclass_init();
+	FrameMark base = frame_mark();
+	char* buf=NULL;
+	size_t len=0;
+	char* line=NULL;
+	size_t lcap=0;
+	jmp_buf jb;
+	/* static, as they change between setjmp and a longjmp out of die */
+	static TokVec tv;
+	static BlockNode input;
+	for(;;) {
+		if(tty) {
+			fputs(len? "  ... " : "slug> ", stdout);
+			fflush(stdout);
+		}
+		ssize_t r=getline(&line, &lcap, stdin);
+		if(r<0) break;
+		buf=(char*)realloc(buf, len+(size_t)r+1);
+		memcpy(buf+len, line, (size_t)r+1);
+		len+=(size_t)r;
+		if(!input_complete(buf)) continue;
+		tv_init(&tv);
+		input.n=0;
+		if(setjmp(jb)==0) {
+			die_jmp=&jb;
+			tokenize(buf, &tv);
+			Parser P = { .toks=&tv, .i=0, .shadowed=builtins_shadowed(&tv, global) };
+			while(!P_check(&P,T_EOF)) block_push(&input, parse_stmt(&P));
+			budget_start();
+			for(size_t i=0; i<input.n; i++) {
+				capture_pass(input.stmts[i], NULL);
+				(void)eval(input.stmts[i], global);
+			}
+		} else {
+			frame_release(base);
+			stats.depth=0;
+			inline_frame=NULL;
+			gen_current=NULL;
+			prof_sp=0;
+			modules_abandon();
+		}
+		die_jmp=NULL;
+		budget_stop();
+		fflush(stdout);
+		tv_free(&tv);
+		len=0;
+	}
+	if(tty) fputc('\n', stdout);
+	free(input.stmts);
+	free(line);
+	free(buf);
+	return 0;
+}
+
 int main(int argc, char** argv){
+	const char* path=NULL;
+	bool interactive=false;
+	bool opt_report=false;
+	bool emit_c=false;
+	bool snapshot=false;
+	const char* out=NULL;
+	const char* image=NULL;
+	int opt_level=1;
+	bool instrumented=false;
+	bool perf=false;
+	for(int i=1; i<argc; i++) {
+		const char* v;
+		if(strcmp(argv[i], "--repl")==0) {
+			interactive=true;
+		} else if(strcmp(argv[i], "--stats")==0) {
+			stats_enabled=true;
+		} else if(strcmp(argv[i], "--instrumented")==0) {
+			instrumented=true;
+		} else if(strcmp(argv[i], "--perf-counters")==0) {
+			perf=true;
+		} else if(strcmp(argv[i], "--perf-counters=statements")==0) {
+			perf=true;
+			perf_stmts=true;
+		} else if(strcmp(argv[i], "--emit-c")==0) {
+			emit_c=true;
+		} else if(strcmp(argv[i], "--verbose")==0) {
+			verbose=true;
+		} else if(strcmp(argv[i], "--snapshot")==0) {
+			snapshot=true;
+		} else if((v=opt_value(argc, argv, &i, "-o"))) {
+			out=v;
+		} else if((v=opt_value(argc, argv, &i, "--sample-profile"))) {
+			char* end;
+			prof_hz = strtol(v, &end, 10);
+			if(end==v || *end!='\0' || prof_hz<=0 || prof_hz>100000) {
+				fprintf(stderr,"invalid value for --sample-profile: %s\n", v);
+				return 1;
+			}
+		} else if((v=opt_value(argc, argv, &i, "--profile-out"))) {
+			prof_out=v;
+		} else if((v=opt_value(argc, argv, &i, "--image"))) {
+			image=v;
+		} else if(strcmp(argv[i], "--opt-report")==0) {
+			opt_report=true;
+		} else if(strcmp(argv[i], "-O0")==0 || strcmp(argv[i], "-O1")==0) {
+			opt_level=argv[i][2]-'0';
+		} else if((v=opt_value(argc, argv, &i, "--max-steps"))) {
+			unsigned long long n=parse_size(v, "--max-steps");
+			budget_steps = n>LONG_MAX? LONG_MAX : (long)n;
+		} else if((v=opt_value(argc, argv, &i, "--max-heap"))) {
+			heap_max = (size_t)parse_size(v, "--max-heap");
+		} else if((v=opt_value(argc, argv, &i, "--timeout"))) {
+			char* end;
+			budget_timeout = strtod(v, &end);
+			if(end==v || *end!='\0' || budget_timeout<=0) {
+				fprintf(stderr,"invalid value for --timeout: %s\n", v);
+				return 1;
+			}
+		} else if(argv[i][0]=='-' && argv[i][1]=='-') {
+			fprintf(stderr,"unknown option: %s\n", argv[i]);
+			return 1;
+		} else {
+			path=argv[i];
+		}
+	}
+	if(snapshot && !out) {
+		fprintf(stderr,"--snapshot expects -o FILE\n");
+		return 1;
+	}
+	if(emit_c && image) {
+		fprintf(stderr,"--emit-c cannot start from an image\n");
+		return 1;
+	}
+	if(instrumented || stats_enabled) {
+		eval=eval_instr;
+		env_release=env_release_instr;
+	} else if(prof_hz>0 || budget_steps>0 || heap_max!=SIZE_MAX || budget_timeout>0) {
+		eval=eval_guard;
+		env_release=env_release_guard;
+	}
+	atexit(stats_report);
+	if(perf) {
+		perf_start();
+		perf_phase("load");
+	}
+	Env* global = image? image_load(image) : env_new(NULL);
+	if(!path && !emit_c && !snapshot && (interactive || isatty(STDIN_FILENO))) {
+		prof_start();
+		return repl(global);
+	}
 	char* src=NULL;
-	if(argc>=2) {
-		src = fslurp(argv[1]);
+	if(path) {
+		src = fslurp(path);
 		if(!src) {
-			fprintf(stderr,"could not read script: %s\n", argv[1]);
+			fprintf(stderr,"could not read script: %s\n", path);
 			return 1;
 		}
 	} else {
@@ -1131,12 +4110,45 @@ int main(int argc, char** argv){
 		src[n]='\0';
 	}
 	TokVec tv;
+	perf_phase("tokenize");
 	tokenize(src, &tv);
-	Parser P = { .toks=&tv, .i=0 };
+	char* dir = path? path_dir(path) : NULL;
+	Module* self = path? module_enter(path) : NULL;
+	Parser P = { .toks=&tv, .i=0, .dir=dir, .shadowed=builtins_shadowed(&tv, global) };
+	perf_phase("parse");
 	AST* prog = parse_program(&P);
-	Env* global = env_new(NULL);
-	(void)eval(prog, global);
+	if(self) self->loading=false;
+	perf_phase("analyse");
+	capture_pass(prog, NULL);
+	if(emit_c) {
+		emit_program(prog, stdout);
+		return 0;
+	}
+	/* a prelude's names can be rebound by any job, so it is not optimised */
+	if(opt_level>0 && !snapshot) {
+		type_pass(prog, opt_report);
+		inline_pass(prog, opt_report);
+	}
+	budget_start();
+	prof_start();
+	if(perf_stmts && prog->tag==A_BLOCK) {
+		for(size_t i=0; i<prog->block.n; i++) {
+			AST* stmt=prog->block.stmts[i];
+			char label[24];
+			snprintf(label, sizeof label, "line %u", (unsigned)stmt->line);
+			perf_phase(label);
+			prof_line=stmt->line;
+			(void)eval(stmt, global);
+		}
+	} else {
+		perf_phase("evaluate");
+		(void)eval(prog, global);
+	}
+	perf_phase(NULL);
+	if(snapshot) image_write(out, global, prog);
 	tv_free(&tv);
+	free(P.imports);
+	free(dir);
 	free(src);
 	return 0;
 }
@@ -0,0 +1,552 @@
+/*
+ * Copyright (C) 2025 Ivan Gaydardzhiev
+ * Licensed under the GPL-3.0-only
+ */
+
+/*
+ * Evaluator template. slug.c includes this file once per variant, with
+ * EV(name) naming the variant's copy of each function. EV_STATS chooses
+ * whether it carries the --stats hooks: node counts, call depth, lookup
+ * histograms and allocation counters. EV_GUARDS chooses the hooks that
+ * budgets and the profiler need: fuel at back edges and calls, live heap
+ * accounting and the profiler's shadow stack. A hook that is left out
+ * expands to nothing, so the lean variant, which has neither, runs the
+ * hot path a build without them would have. The shared allocators do no
+ * accounting of their own; the template charges their callers' bytes.
+ */
+
+#if EV_STATS
+#define EV_NODE(a) stats.nodes[(a)->tag]++
+#define EV_ENTER() do { stats.calls++; if(++stats.depth>stats.max_depth) stats.max_depth=stats.depth; } while(0)
+#define EV_LEAVE() stats.depth--
+#define EV_ALLOC(kind, n) STAT_ALLOC(kind, n)
+#else
+#define EV_NODE(a) ((void)0)
+#define EV_ENTER() ((void)0)
+#define EV_LEAVE() ((void)0)
+#define EV_ALLOC(kind, n) ((void)0)
+#endif
+
+#if EV_GUARDS
+#define EV_STEP() BUDGET_STEP()
+#define EV_PUSH(f, l) PROF_PUSH(f, l)
+#define EV_POP(l) PROF_POP(l)
+#define EV_LINE(l) prof_line=(l)
+#define EV_HEAP(n) HEAP_CHARGE(n)
+#define EV_CREDIT(n) HEAP_CREDIT(n)
+#else
+#define EV_STEP() ((void)0)
+#define EV_PUSH(f, l) ((void)0)
+#define EV_POP(l) ((void)0)
+#define EV_LINE(l) ((void)0)
+#define EV_HEAP(n) ((void)0)
+#define EV_CREDIT(n) ((void)0)
+#endif
+
+#define EV_CHARGE(kind, n) do { EV_ALLOC(kind, n); EV_HEAP(n); } while(0)
+#define EV_FRAME(n) EV_ALLOC(K_FRAME, n)
+
+static Env* EV(env_new_frame)(Env* parent) {
+	EV_FRAME(sizeof(Env));
+	Env* e=(Env*)frame_alloc(sizeof(Env));
+	e->head=NULL;
+	e->parent=parent;
+	e->cells=NULL;
+	e->ncells=0;
+	e->stack=true;
+	e->captured=false;
+	return e;
+}
+
+#if EV_STATS
+#define EV_HIST() do { \
+	stats.hops[hops<STAT_LINEAR? hops : STAT_LINEAR]++; \
+	stats.cmps[cmps<STAT_LINEAR? cmps : STAT_LINEAR]++; \
+} while(0)
+#endif
+
+static Entry* EV(env_find)(Env* e, const char* name) {
+#if EV_STATS
+	unsigned hops=0, cmps=0;
+	stats.lookups++;
+	for(Env* cur=e; cur; cur=cur->parent, hops++) {
+		for(Entry* it=cur->head; it; it=it->next) {
+			cmps++;
+			if(strcmp(it->name,name)==0) {
+				EV_HIST();
+				return it;
+			}
+		}
+		for(size_t i=0; i<cur->ncells; i++) {
+			cmps++;
+			if(strcmp(cur->cells[i]->name,name)==0) {
+				EV_HIST();
+				return cur->cells[i];
+			}
+		}
+	}
+	stats.misses++;
+	EV_HIST();
+#undef EV_HIST
+#else
+	for(Env* cur=e; cur; cur=cur->parent) {
+		for(Entry* it=cur->head; it; it=it->next) if(strcmp(it->name,name)==0) return it;
+		for(size_t i=0; i<cur->ncells; i++) if(strcmp(cur->cells[i]->name,name)==0) return cur->cells[i];
+	}
+#endif
+	return NULL;
+}
+static void EV(env_define)(Env* e, const char* name, Val v, bool c) {
+	Entry* en=EV(env_find)(e,name);
+	if(en) {
+		if(en->constant) dief("cannot reassign const %s", name);
+		en->val=v;
+		en->constant=c;
+		return;
+	}
+	if(e->stack) {
+		/* names are owned by the AST, which outlives every frame */
+		EV_FRAME(sizeof(Entry));
+		en=(Entry*)frame_alloc(sizeof(Entry));
+		en->name=(char*)name;
+		en->val=v;
+		en->constant=c;
+		en->boxed=false;
+		en->next=e->head;
+		e->head=en;
+		return;
+	}
+	size_t len=strlen(name)+1;
+	EV_CHARGE(K_ENTRY, sizeof(Entry)+len);
+	en=(Entry*)malloc(sizeof(Entry));
+	en->name=(char*)malloc(len);
+	memcpy(en->name, name, len);
+	en->val=v;
+	en->constant=c;
+	en->boxed=false;
+	en->next=e->head;
+	e->head=en;
+}
+
+/* frees a heap call Env on return unless a closure still refers to it */
+static void EV(env_release)(Env* e) {
+	if(e->captured) return;
+	for(Entry* it=e->head, *next; it; it=next) {
+		next=it->next;
+		if(it->boxed) {
+			it->next=NULL;
+			continue;
+		}
+		EV_CREDIT(sizeof(Entry)+strlen(it->name)+1);
+		free(it->name);
+		free(it);
+	}
+	EV_CREDIT(sizeof(Env));
+	free(e);
+}
+
+/* map_set, with the table it allocates when it grows charged in place of the one it frees */
+static void EV(map_store)(Map* m, Val k, Val v) {
+	const int8_t* ctrl=m->ctrl;
+	size_t old = m->owned? map_bytes(m) : 0;
+	map_set(m, k, v);
+	if(m->ctrl!=ctrl) {
+		EV_CHARGE(K_MAP, map_bytes(m));
+		EV_CREDIT(old);
+	}
+	(void)old;
+}
+
+/*
+ * Environment for a closure over f created in e. Each listed name is
+ * resolved once, and since bindings are never removed and a define
+ * only adds a name that no Env on the chain has, later lookups from e
+ * would find the same Entry. An unresolved late name could still be
+ * bound in e's chain, so f then keeps the whole chain, as before.
+ */
+static Env* EV(closure_env)(AST* f, Env* e) {
+	Env* global=e;
+	while(global->parent) global=global->parent;
+	if(e==global) return e;
+	size_t n=f->fn.ncaps, k=0;
+	Entry** cells=(Entry**)malloc((n? n : 1)*sizeof(Entry*));
+	for(size_t i=0; i<n; i++) {
+		Entry* en=EV(env_find)(e, f->fn.caps[i].name);
+		if(en) cells[k++]=en;
+		else if(f->fn.caps[i].late) {
+			free(cells);
+			e->captured=true;
+			return e;
+		}
+	}
+	if(!k) {
+		free(cells);
+		return global;
+	}
+	for(size_t i=0; i<k; i++) cells[i]->boxed=true;
+	EV_CHARGE(K_CLOSURE, k*sizeof(Entry*));
+	EV_CHARGE(K_ENV, sizeof(Env));
+	Env* cap=env_new(global);
+	cap->cells=cells;
+	cap->ncells=k;
+	return cap;
+}
+
+static bool EV(env_assign)(Env* e, const char* name, Val v) {
+	Entry* en=EV(env_find)(e,name);
+	if(!en) return false;
+	if(en->constant) dief("cannot assign to const %s", name);
+	en->val=v;
+	return true;
+}
+
+static Val EV(eval)(AST* a, Env* env);
+
+static Val EV(eval_block)(AST* a, Env* env) {
+	Val last = VNull();
+	if(!a) return last;
+	AST** s=a->block.stmts;
+	for(size_t i=0, n=a->block.n; i<n; i++) {
+		EV_LINE(s[i]->line);
+		last = EV(eval)(s[i], env);
+	}
+	return last;
+}
+
+static Val EV(eval)(AST* a, Env* env) {
+	if(!a) return VNull();
+	EV_NODE(a);
+	switch(a->tag) {
+	case A_NUM:
+		return VNum(a->num);
+	case A_BOOL:
+		return VBool(a->boolean);
+	case A_ID: {
+		Entry* en=EV(env_find)(env, a->id.name);
+		if(!en) dief("undefined variable %s", a->id.name);
+		return en->val;
+	}
+	case A_LET: {
+		Val v = EV(eval)(a->var_.expr, env);
+		EV(env_define)(env, a->var_.id->id.name, v, a->var_.constant);
+		return v;
+	}
+	case A_ASSIGN: {
+		Val v = EV(eval)(a->asn.expr, env);
+		if(!EV(env_assign)(env, a->asn.id->id.name, v))
+			dief("assign to undefined variable %s", a->asn.id->id.name);
+		return v;
+	}
+	case A_UN: {
+		Val v=EV(eval)(a->un.expr, env);
+		if(a->un.op==U_NEG) {
+			if(!a->typed) want_num(v,"-");
+			return VNum(-v.as.i);
+		} else {
+			if(!a->typed) want_bool(v,"!");
+			return VBool(!v.as.b);
+		}
+	}
+	case A_BIN: {
+		Val L=EV(eval)(a->bin.left, env);
+		if(a->bin.op==B_AND) {
+			if(!a->typed) want_bool(L,"&&");
+			if(!L.as.b) return VBool(false);
+			Val R=EV(eval)(a->bin.right, env);
+			if(!a->typed) want_bool(R,"&&");
+			return VBool(L.as.b && R.as.b);
+		}
+		if(a->bin.op==B_OR) {
+			if(!a->typed) want_bool(L,"||");
+			if(L.as.b) return VBool(true);
+			Val R=EV(eval)(a->bin.right, env);
+			if(!a->typed) want_bool(R,"||");
+			return VBool(L.as.b || R.as.b);
+		}
+		Val R=EV(eval)(a->bin.right, env);
+		switch(a->bin.op) {
+		case B_ADD:
+			if(!a->typed) {
+				want_num(L,"+");
+				want_num(R,"+");
+			}
+			return VNum(L.as.i + R.as.i);
+		case B_SUB:
+			if(!a->typed) {
+				want_num(L,"-");
+				want_num(R,"-");
+			}
+			return VNum(L.as.i - R.as.i);
+		case B_MUL:
+			if(!a->typed) {
+				want_num(L,"*");
+				want_num(R,"*");
+			}
+			return VNum(L.as.i * R.as.i);
+		case B_DIV:
+			if(!a->typed) {
+				want_num(L,"/");
+				want_num(R,"/");
+			}
+			if(R.as.i==0) die("division by zero");
+			return VNum(L.as.i / R.as.i);
+		case B_MOD:
+			if(!a->typed) {
+				want_num(L,"%");
+				want_num(R,"%");
+			}
+			if(R.as.i==0) die("modulus by zero");
+			return VNum(L.as.i % R.as.i);
+		case B_LT:
+			if(!a->typed) {
+				want_num(L,"<");
+				want_num(R,"<");
+			}
+			return VBool(L.as.i <  R.as.i);
+		case B_LE:
+			if(!a->typed) {
+				want_num(L,"<=");
+				want_num(R,"<=");
+			}
+			return VBool(L.as.i <= R.as.i);
+		case B_GT:
+			if(!a->typed) {
+				want_num(L,">");
+				want_num(R,">");
+			}
+			return VBool(L.as.i >  R.as.i);
+		case B_GE:
+			if(!a->typed) {
+				want_num(L,">=");
+				want_num(R,">=");
+			}
+			return VBool(L.as.i >= R.as.i);
+		case B_EQ:
+			if(L.tag!=R.tag) return VBool(false);
+			if(L.tag==V_NUM) return VBool(L.as.i==R.as.i);
+			if(L.tag==V_BOOL) return VBool(L.as.b==R.as.b);
+			return VBool(false);
+		case B_NE:
+			if(L.tag!=R.tag) return VBool(true);
+			if(L.tag==V_NUM) return VBool(L.as.i!=R.as.i);
+			if(L.tag==V_BOOL) return VBool(L.as.b!=R.as.b);
+			return VBool(true);
+		default:
+			die("internal bin op");
+		}
+	}
+	case A_BLOCK:
+		return EV(eval_block)(a, env);
+	case A_IFELSE: {
+		for(size_t i=0; i<a->iff.n; i++) {
+			Val v=EV(eval)(a->iff.conds[i], env);
+			if(!a->typed) want_bool(v,"if/elif");
+			if(v.as.b) return EV(eval)(a->iff.bodies[i], env);
+		}
+		if(a->iff.elseBody) return EV(eval)(a->iff.elseBody, env);
+		return VNull();
+	}
+	case A_WHILE: {
+		Val last=VNull();
+		for(;;) {
+			Val c=EV(eval)(a->wh.cond, env);
+			if(!a->typed) want_bool(c,"while");
+			if(!c.as.b) break;
+			last=EV(eval)(a->wh.body, env);
+			EV_STEP();
+		}
+		return last;
+	}
+	case A_FOR: {
+		/*
+		 * The bounds are evaluated once and the induction variable is
+		 * bound once; each iteration only stores the counter into the
+		 * binding's slot, so the loop overhead is compare and increment.
+		 */
+		Val from=EV(eval)(a->fr.from, env);
+		if(!a->typed) want_num(from,"for");
+		Val to=EV(eval)(a->fr.to, env);
+		if(!a->typed) want_num(to,"for");
+		EV(env_define)(env, a->fr.id->id.name, from, false);
+		Entry* slot=EV(env_find)(env, a->fr.id->id.name);
+		Val last=VNull();
+		int i=from.as.i;
+		for(; i<to.as.i; i++) {
+			slot->val.tag=V_NUM;
+			slot->val.as.i=i;
+			last=EV(eval)(a->fr.body, env);
+			EV_STEP();
+		}
+		slot->val=VNum(i);
+		return last;
+	}
+	case A_FUNC_LIT:
+		EV_CHARGE(K_CLOSURE, sizeof(Closure));
+		return VFunc((AST*)a, EV(closure_env)(a, env));
+	case A_CALL: {
+		EV_STEP();
+		Val cal = EV(eval)(a->call.callee, env);
+		if(cal.tag!=V_FUNC) die("attempt to call non-function");
+		Closure* cl=cal.as.fn;
+		AST* fn=cl->fun;
+		size_t nparams=fn->fn.nparams;
+		if(a->call.nargs!=nparams) dief("arity mismatch: expected %zu args, got %zu", nparams, a->call.nargs);
+		EV_ENTER();
+		Val r;
+		if(fn->fn.noescape) {
+			FrameMark m=frame_mark();
+			Env* callenv = EV(env_new_frame)(cl->env);
+			for(size_t i=0; i<nparams; i++) {
+				AST* pid = fn->fn.params[i];
+				Val arg = EV(eval)(a->call.args[i], env);
+				EV(env_define)(callenv, pid->id.name, arg, false);
+			}
+			EV_PUSH(fn, a->line);
+			r = EV(eval)(fn->fn.body, callenv);
+			EV_POP(a->line);
+			frame_release(m);
+		} else {
+			EV_CHARGE(K_ENV, sizeof(Env));
+			Env* callenv = env_new(cl->env);
+			for(size_t i=0; i<nparams; i++) {
+				AST* pid = fn->fn.params[i];
+				Val arg = EV(eval)(a->call.args[i], env);
+				EV(env_define)(callenv, pid->id.name, arg, false);
+			}
+			if(fn->fn.gen) {
+				EV_CHARGE(K_CLOSURE, sizeof(Gen));
+				r = VGen(fn, callenv);
+			} else {
+				EV_PUSH(fn, a->line);
+				r = EV(eval)(fn->fn.body, callenv);
+				EV_POP(a->line);
+				EV(env_release)(callenv);
+			}
+		}
+		EV_LEAVE();
+		return r;
+	}
+	case A_INLINE: {
+		Val args[INLINE_MAX_PARAMS];
+		for(size_t i=0; i<a->inl.nargs; i++) args[i]=EV(eval)(a->inl.args[i], env);
+		Val* saved=inline_frame;
+		inline_frame=args;
+		Val r=EV(eval)(a->inl.body, env);
+		inline_frame=saved;
+		return r;
+	}
+	case A_PARAM_REF:
+		return inline_frame[a->pref.index];
+	case A_YIELD:
+		gen_yield(EV(eval)(a->yld.expr, env));
+		return VNull();
+	case A_IMPORT: {
+		Module* m=a->imp.mod;
+		if(!m->evaluated) {
+			double t=now_ms();
+			m->evaluated=true;
+			(void)EV(eval)(m->body, env);
+			if(verbose) fprintf(stderr, "module %s: evaluated in %.3f ms\n", m->path, now_ms()-t);
+		}
+		return VNull();
+	}
+	case A_BUILTIN: {
+		switch(a->builtin.bi) {
+		case BUILTIN_OUTN: {
+			if(a->builtin.nargs!=1) die("outn expects 1 argument");
+			Val v=EV(eval)(a->builtin.args[0], env);
+			switch(v.tag) {
+			case V_NUM:
+				printf("%d\n", v.as.i);
+				break;
+			case V_BOOL:
+				printf("%s\n", v.as.b? "true":"false");
+				break;
+			case V_FUNC:
+				printf("<function>\n");
+				break;
+			case V_GEN:
+				printf("<generator>\n");
+				break;
+			case V_MAP:
+				printf("<map>\n");
+				break;
+			default:
+				printf("null\n");
+				break;
+			}
+			return VBool(true);
+		}
+		case BUILTIN_NEXT: {
+			Gen* g=want_gen(EV(eval)(a->builtin.args[0], env), "next");
+			if(!g->has_val && !g->done) gen_advance(g);
+			if(!g->has_val) die("next on a finished generator");
+			g->has_val=false;
+			return g->val;
+		}
+		case BUILTIN_DONE: {
+			Gen* g=want_gen(EV(eval)(a->builtin.args[0], env), "done");
+			if(!g->has_val && !g->done) gen_advance(g);
+			return VBool(!g->has_val);
+		}
+		case BUILTIN_MAP: {
+			AST** args=a->builtin.args;
+			Val m=VMap(a->builtin.nargs/2);
+			EV_CHARGE(K_MAP, sizeof(Map));
+			EV_CHARGE(K_MAP, map_bytes(m.as.map));
+			for(size_t i=0; i<a->builtin.nargs; i+=2) {
+				Val k=EV(eval)(args[i], env);
+				EV(map_store)(m.as.map, k, EV(eval)(args[i+1], env));
+			}
+			return m;
+		}
+		case BUILTIN_INDEX:
+		case BUILTIN_GET: {
+			bool idx = a->builtin.bi==BUILTIN_INDEX;
+			Map* m=want_map(EV(eval)(a->builtin.args[0], env), idx? "indexing" : "get");
+			MapSlot* it=map_find(m, map_key(EV(eval)(a->builtin.args[1], env)));
+			if(it) return it->val;
+			if(idx) die("key not in map");
+			return VNull();
+		}
+		case BUILTIN_SET: {
+			Map* m=want_map(EV(eval)(a->builtin.args[0], env), "set");
+			Val k=EV(eval)(a->builtin.args[1], env);
+			Val v=EV(eval)(a->builtin.args[2], env);
+			EV(map_store)(m, k, v);
+			return v;
+		}
+		case BUILTIN_HAS: {
+			Map* m=want_map(EV(eval)(a->builtin.args[0], env), "has");
+			return VBool(map_find(m, map_key(EV(eval)(a->builtin.args[1], env)))!=NULL);
+		}
+		case BUILTIN_DELETE: {
+			Map* m=want_map(EV(eval)(a->builtin.args[0], env), "delete");
+			return VBool(map_delete(m, EV(eval)(a->builtin.args[1], env)));
+		}
+		case BUILTIN_SIZE:
+			return VNum((int)want_map(EV(eval)(a->builtin.args[0], env), "size")->size);
+		}
+		die("unknown builtin");
+	}
+	default:
+		die("not implemented ast node");
+	}
+	return VNull();
+}
+
+#undef EV_NODE
+#undef EV_STEP
+#undef EV_ENTER
+#undef EV_LEAVE
+#undef EV_PUSH
+#undef EV_POP
+#undef EV_LINE
+#undef EV_CHARGE
+#undef EV_CREDIT
+#undef EV_FRAME
+#undef EV_ALLOC
+#undef EV_HEAP
+#undef EV_STATS
+#undef EV_GUARDS
+#undef EV
@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2025 Ivan Gaydardzhiev
+ * Licensed under the GPL-3.0-only
+ */
+
+/*
+ * Runtime for C emitted by `slug --emit-c`. It mirrors the interpreter's
+ * values, environments and error messages so that a compiled script
+ * behaves byte for byte like the interpreted one. Every name in emitted
+ * code is a single static string, so lookups compare pointers instead of
+ * calling strcmp.
+ */
+
+#ifndef SLUG_RT_H
+#define SLUG_RT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+typedef enum {
+	RT_NULL,
+	RT_NUM,
+	RT_BOOL,
+	RT_FUNC
+} rt_tag;
+
+typedef struct rt_env rt_env;
+typedef struct rt_closure rt_closure;
+
+typedef struct {
+	rt_tag tag;
+	union {
+		int i;
+		bool b;
+		rt_closure* fn;
+	} as;
+} rt_val;
+
+typedef rt_val (*rt_code)(rt_env*);
+
+struct rt_closure {
+	rt_code code;
+	const char* const* params;
+	size_t nparams;
+	bool noescape;
+	rt_env* env;
+};
+
+typedef struct rt_entry {
+	const char* name;
+	rt_val val;
+	bool constant;
+	struct rt_entry* next;
+} rt_entry;
+
+struct rt_env {
+	rt_entry* head;
+	rt_env* parent;
+	bool stack;
+};
+
+static void rt_die(const char* fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	fflush(stdout);
+	fprintf(stderr, "runtime error: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	exit(EXIT_FAILURE);
+}
+
+static inline rt_val rt_null(void) {
+	rt_val v;
+	v.tag=RT_NULL;
+	v.as.i=0;
+	return v;
+}
+
+static inline rt_val rt_num(int x) {
+	rt_val v;
+	v.tag=RT_NUM;
+	v.as.i=x;
+	return v;
+}
+
+static inline rt_val rt_bool(bool b) {
+	rt_val v;
+	v.tag=RT_BOOL;
+	v.as.b=b;
+	return v;
+}
+
+static rt_val rt_func(rt_code code, const char* const* params, size_t nparams, bool noescape, rt_env* env) {
+	rt_closure* c=(rt_closure*)malloc(sizeof(rt_closure));
+	c->code=code;
+	c->params=params;
+	c->nparams=nparams;
+	c->noescape=noescape;
+	c->env=env;
+	rt_val v;
+	v.tag=RT_FUNC;
+	v.as.fn=c;
+	return v;
+}
+
+/* frame stack for calls whose environment cannot escape */
+#define RT_FRAME_CHUNK (64*1024)
+
+typedef struct rt_chunk {
+	struct rt_chunk* next;
+	size_t top;
+	char data[RT_FRAME_CHUNK];
+} rt_chunk;
+
+typedef struct {
+	rt_chunk* chunk;
+	size_t top;
+} rt_mark;
+
+static rt_chunk* rt_frames = NULL;
+
+static rt_chunk* rt_chunk_new(rt_chunk* prev) {
+	rt_chunk* c=(rt_chunk*)malloc(sizeof(rt_chunk));
+	if(!c) rt_die("out of memory");
+	c->next=NULL;
+	c->top=0;
+	if(prev) prev->next=c;
+	return c;
+}
+
+static inline rt_mark rt_frame_mark(void) {
+	if(!rt_frames) rt_frames=rt_chunk_new(NULL);
+	rt_mark m;
+	m.chunk=rt_frames;
+	m.top=rt_frames->top;
+	return m;
+}
+
+static inline void rt_frame_release(rt_mark m) {
+	rt_frames=m.chunk;
+	rt_frames->top=m.top;
+}
+
+static inline void* rt_frame_alloc(size_t n) {
+	n=(n+15)&~(size_t)15;
+	if(rt_frames->top+n>RT_FRAME_CHUNK) {
+		rt_frames = rt_frames->next? rt_frames->next : rt_chunk_new(rt_frames);
+		rt_frames->top=0;
+	}
+	void* p=rt_frames->data+rt_frames->top;
+	rt_frames->top+=n;
+	return p;
+}
+
+static rt_env* rt_env_new(rt_env* parent) {
+	rt_env* e=(rt_env*)calloc(1, sizeof(rt_env));
+	e->parent=parent;
+	return e;
+}
+
+static inline rt_entry* rt_find(rt_env* e, const char* name) {
+	for(; e; e=e->parent) {
+		for(rt_entry* it=e->head; it; it=it->next) if(it->name==name) return it;
+	}
+	return NULL;
+}
+
+static void rt_define(rt_env* e, const char* name, rt_val v, bool c) {
+	rt_entry* en=rt_find(e, name);
+	if(en) {
+		if(en->constant) rt_die("cannot reassign const %s", name);
+		en->val=v;
+		en->constant=c;
+		return;
+	}
+	en = e->stack? (rt_entry*)rt_frame_alloc(sizeof(rt_entry)) : (rt_entry*)malloc(sizeof(rt_entry));
+	en->name=name;
+	en->val=v;
+	en->constant=c;
+	en->next=e->head;
+	e->head=en;
+}
+
+static inline rt_val rt_get(rt_env* e, const char* name) {
+	rt_entry* en=rt_find(e, name);
+	if(!en) rt_die("undefined variable %s", name);
+	return en->val;
+}
+
+static inline void rt_assign(rt_env* e, const char* name, rt_val v) {
+	rt_entry* en=rt_find(e, name);
+	if(!en) rt_die("assign to undefined variable %s", name);
+	if(en->constant) rt_die("cannot assign to const %s", name);
+	en->val=v;
+}
+
+static inline void rt_want_num(rt_val v, const char* op) {
+	if(v.tag!=RT_NUM) rt_die("operator '%s' expects number", op);
+}
+
+static inline void rt_want_bool(rt_val v, const char* op) {
+	if(v.tag!=RT_BOOL) rt_die("operator '%s' expects boolean", op);
+}
+
+/* arithmetic wraps like the interpreter's unoptimised build */
+static inline rt_val rt_arith(int op, rt_val l, rt_val r) {
+	static const char* names[] = { "+", "-", "*", "/", "%" };
+	rt_want_num(l, names[op]);
+	rt_want_num(r, names[op]);
+	unsigned a=(unsigned)l.as.i, b=(unsigned)r.as.i;
+	switch(op) {
+	case 0:
+		return rt_num((int)(a+b));
+	case 1:
+		return rt_num((int)(a-b));
+	case 2:
+		return rt_num((int)(a*b));
+	case 3:
+		if(r.as.i==0) rt_die("division by zero");
+		return rt_num(l.as.i / r.as.i);
+	default:
+		if(r.as.i==0) rt_die("modulus by zero");
+		return rt_num(l.as.i % r.as.i);
+	}
+}
+
+static inline rt_val rt_cmp(int op, rt_val l, rt_val r) {
+	static const char* names[] = { "<", "<=", ">", ">=" };
+	rt_want_num(l, names[op]);
+	rt_want_num(r, names[op]);
+	switch(op) {
+	case 0:
+		return rt_bool(l.as.i < r.as.i);
+	case 1:
+		return rt_bool(l.as.i <= r.as.i);
+	case 2:
+		return rt_bool(l.as.i > r.as.i);
+	default:
+		return rt_bool(l.as.i >= r.as.i);
+	}
+}
+
+static inline rt_val rt_eq(rt_val l, rt_val r, bool ne) {
+	bool eq;
+	if(l.tag!=r.tag) eq=false;
+	else if(l.tag==RT_NUM) eq = l.as.i==r.as.i;
+	else if(l.tag==RT_BOOL) eq = l.as.b==r.as.b;
+	else eq=false;
+	return rt_bool(ne? !eq : eq);
+}
+
+static inline rt_val rt_neg(rt_val v) {
+	rt_want_num(v, "-");
+	return rt_num((int)(0u-(unsigned)v.as.i));
+}
+
+static inline rt_val rt_not(rt_val v) {
+	rt_want_bool(v, "!");
+	return rt_bool(!v.as.b);
+}
+
+static inline rt_closure* rt_callee(rt_val v, size_t nargs) {
+	if(v.tag!=RT_FUNC) rt_die("attempt to call non-function");
+	if(v.as.fn->nparams!=nargs) rt_die("arity mismatch: expected %zu args, got %zu", v.as.fn->nparams, nargs);
+	return v.as.fn;
+}
+
+static inline rt_env* rt_call_env(rt_closure* c) {
+	if(!c->noescape) return rt_env_new(c->env);
+	rt_env* e=(rt_env*)rt_frame_alloc(sizeof(rt_env));
+	e->head=NULL;
+	e->parent=c->env;
+	e->stack=true;
+	return e;
+}
+
+static inline rt_val rt_outn(rt_val v) {
+	switch(v.tag) {
+	case RT_NUM:
+		printf("%d\n", v.as.i);
+		break;
+	case RT_BOOL:
+		printf("%s\n", v.as.b? "true":"false");
+		break;
+	case RT_FUNC:
+		printf("<function>\n");
+		break;
+	default:
+		printf("null\n");
+		break;
+	}
+	return rt_bool(true);
+}
+
+#endif
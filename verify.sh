@@ -8,12 +8,15 @@ N='\033[0m'
 
 [ ! -f slug ] && make
 
+# SLUG_FLAGS=--instrumented runs every test on the instrumented evaluator
+SLUG="./slug ${SLUG_FLAGS}"
+
 fprint() {
 	 printf "[%s] Test: %-20s Result: %b\n" "$(date '+%Y-%m-%d %H:%M:%S')" "${1}" "${2}"
 }
 
 test_ackermann() {
-	capture=$(./slug scripts/ackermann.slg)
+	capture=$(${SLUG} scripts/ackermann.slg)
 	[ "${capture}" = "1021" ] && {
 		fprint "Ackermann(3,7)" "${G}PASSED${N}";
 		return 0;
@@ -24,7 +27,7 @@ test_ackermann() {
 }
 
 test_increment() {
-	capture=$(./slug scripts/anon_func.slg)
+	capture=$(${SLUG} scripts/anon_func.slg)
 	[ "${capture}" = "8" ] && {
 		fprint "Increment" "${G}PASSED${N}";
 		return 0;
@@ -37,7 +40,7 @@ test_increment() {
 test_core_lang() {
 	expected="20\n1\n0\n1\n2\n3\n4\n20\n15\n42"
 	expected=$(printf '%b' "${expected}")
-	capture=$(./slug scripts/core_language_test.slg)
+	capture=$(${SLUG} scripts/core_language_test.slg)
 	[ "${capture}" = "${expected}" ] && {
 		fprint "Core Language" "${G}PASSED${N}";
 		return 0;
@@ -48,7 +51,7 @@ test_core_lang() {
 }
 
 test_turing() {
-	capture=$(./slug scripts/turing.slg)
+	capture=$(${SLUG} scripts/turing.slg)
 	[ "${capture}" = "120" ] && {
 		fprint "Turing Completeness" "${G}PASSED${N}";
 		return 0;
@@ -59,7 +62,7 @@ test_turing() {
 }
 
 test_hof() {
-	capture=$(./slug scripts/higher_order_functions_and_closures.slg)
+	capture=$(${SLUG} scripts/higher_order_functions_and_closures.slg)
 	[ "${capture}" = "25" ] && {
 		fprint "Higher Order" "${G}PASSED${N}";
 		return 0;
@@ -70,7 +73,7 @@ test_hof() {
 }
 
 test_recursion() {
-	capture=$(./slug scripts/recursion.slg)
+	capture=$(${SLUG} scripts/recursion.slg)
 	[ "${capture}" = "120" ] && {
 		fprint "Recursion" "${G}PASSED${N}";
 		return 0;
@@ -83,7 +86,7 @@ test_recursion() {
 test_demorgan() {
 	expected="true\ntrue\ntrue\ntrue\n"
 	expected=$(printf %b "${expected}")
-	capture=$(./slug scripts/demorgan_law.slg)
+	capture=$(${SLUG} scripts/demorgan_law.slg)
 	[ "${capture}" = "${expected}" ] && {
 		fprint "DeMorgan" "${G}PASSED${N}";
 		return 0;
@@ -96,7 +99,7 @@ test_demorgan() {
 test_truth() {
 	expected="true\ntrue\ntrue\ntrue\n"
 	expected=$(printf %b "${expected}")
-	capture=$(./slug scripts/truth_table_testing.slg)
+	capture=$(${SLUG} scripts/truth_table_testing.slg)
 	[ "${capture}" = "${expected}" ] && {
 		fprint "Truth Table" "${G}PASSED${N}";
 		return 0;
@@ -107,7 +110,7 @@ test_truth() {
 }
 
 test_entscheidungs() {
-	capture=$(./slug scripts/entscheidungs_problem.slg)
+	capture=$(${SLUG} scripts/entscheidungs_problem.slg)
 	[ "${capture}" = "0" ] && {
 		fprint "EntscheidungsProblem" "${G}CONFIRMED${N}";
 		return 0;
@@ -118,7 +121,7 @@ test_entscheidungs() {
 }
 
 test_halting() {
-	capture=$(./slug scripts/halting_paradox.slg)
+	capture=$(${SLUG} scripts/halting_paradox.slg)
 	[ "${capture}" = "0" ] && {
 		fprint "Halting Paradox" "${G}CONFIRMED${N}";
 		return 0;
@@ -130,7 +133,7 @@ test_halting() {
 
 test_purediag() {
 	exec 3>&2 2>/dev/null
-	./slug scripts/pure_diag.slg
+	${SLUG} scripts/pure_diag.slg
 	capture="${?}"
 	exec 2>&3 3>&-
 	[ "${capture}" = "139" ] && {
@@ -142,8 +145,246 @@ test_purediag() {
 	}
 }
 
+test_counted_loop() {
+	expected="45\n10\n5050"
+	expected=$(printf '%b' "${expected}")
+	capture=$(${SLUG} scripts/counted_loop.slg)
+	[ "${capture}" = "${expected}" ] && {
+		fprint "Counted Loop" "${G}PASSED${N}";
+		return 0;
+	} || {
+		fprint "Counted Loop" "${R}FAILED${N}";
+		return 15;
+	}
+}
+
+test_flat_block() {
+	script=$(mktemp)
+	awk 'BEGIN { print "var x = 0;"; for(i=0; i<1000000; i++) print "x = x + 1;"; print "outn(x);" }' > "${script}"
+	capture=$(ulimit -s 256; ${SLUG} "${script}" 2>/dev/null)
+	rm -f "${script}"
+	[ "${capture}" = "1000000" ] && {
+		fprint "Flat Block 10^6" "${G}PASSED${N}";
+		return 0;
+	} || {
+		fprint "Flat Block 10^6" "${R}FAILED${N}";
+		return 13;
+	}
+}
+
+test_budget() {
+	capture=$(printf 'while (true) { }' | ${SLUG} --max-steps 1000 2>&1)
+	steps="${?}"
+	growing=$(printf '%s\n' 'var n = 0;' 'while (true) { var f = func() => n; }' | ${SLUG} --max-heap 1M 2>&1)
+	bounded=$(printf '%s\n' 'var id = func(x) => { if (x < 0) { func() => x; } else { x; } };' 'var s = 0;' 'for i in 0..200000 { s = s + id(1); }' 'outn(s);' | ${SLUG} --max-heap 64K 2>&1)
+	timeout=$(printf 'while (true) { }' | ${SLUG} --timeout 0.2 2>&1)
+	overflow=$(printf 'outn(1);' | ${SLUG} --max-heap 17179869184G 2>&1)
+	[ "${steps}" = "1" ] && [ "${capture}" = "runtime error: step budget exhausted after 1000 steps" ] && \
+		[ "${growing}" = "runtime error: heap budget exhausted: 1048576 bytes allowed" ] && [ "${bounded}" = "200000" ] && \
+		[ "${timeout}" = "runtime error: timeout: execution exceeded 0.2s" ] && [ "${overflow}" = "invalid value for --max-heap: 17179869184G" ] && {
+		fprint "Budgets" "${G}PASSED${N}";
+		return 0;
+	} || {
+		fprint "Budgets" "${R}FAILED${N}";
+		return 14;
+	}
+}
+
+test_repl() {
+	expected="16\n120\n36\n1"
+	expected=$(printf '%b' "${expected}")
+	capture=$(printf 'var sq = func(n) => n * n;\noutn(sq(4));\nvar f = func(n) => {\n  if (n == 0) { 1; } else { n * f(n - 1); }\n};\noutn(f(5));\noutn(missing);\noutn(sq(f(3)));\nvar z = 1;\nz = 2; z = = 3;\noutn(z);\n' | ${SLUG} --repl 2>/dev/null)
+	[ "${capture}" = "${expected}" ] && {
+		fprint "REPL" "${G}PASSED${N}";
+		return 0;
+	} || {
+		fprint "REPL" "${R}FAILED${N}";
+		return 16;
+	}
+}
+
+test_stats() {
+	capture=$(${SLUG} --stats scripts/recursion.slg 2>&1 >/dev/null | grep -c -e '"calls": 6,' -e '"max_depth": 6,')
+	deep=$(i=0; while [ "${i}" -lt 100 ]; do echo "var g${i} = ${i};"; i=$((i + 1)); done; echo 'outn(g0);')
+	deep=$(printf '%s\n' "${deep}" | ${SLUG} --stats 2>&1 >/dev/null | grep -c '"lookup_strcmp": .*"32-63": 32, "64+": 37}')
+	[ "${capture}" = "2" ] && [ "${deep}" = "1" ] && {
+		fprint "Runtime Stats" "${G}PASSED${N}";
+		return 0;
+	} || {
+		fprint "Runtime Stats" "${R}FAILED${N}";
+		return 17;
+	}
+}
+
+test_inline() {
+	report=$(${SLUG} --opt-report scripts/collatz.slg 2>&1 >/dev/null | grep "^inline:")
+	capture=$(${SLUG} scripts/collatz.slg)
+	[ "${capture}" = "111" ] && [ "${report}" = "$(printf 'inline: even -> 1 call site\ninline: 1 call site inlined')" ] && {
+		fprint "Inlining" "${G}PASSED${N}";
+		return 0;
+	} || {
+		fprint "Inlining" "${R}FAILED${N}";
+		return 18;
+	}
+}
+
+test_aot() {
+	make -s aot >/dev/null 2>&1 || {
+		fprint "AOT Compile" "${R}FAILED${N}";
+		return 19;
+	}
+	for f in scripts/*.slg; do
+		n=$(basename "${f}" .slg)
+		[ -x "./aot/${n}" ] || continue
+		[ "$(${SLUG} "${f}" 2>&1; echo "${?}")" = "$(./aot/"${n}" 2>&1; echo "${?}")" ] || {
+			fprint "AOT Compile" "${R}FAILED${N}";
+			return 19;
+		}
+	done
+	fprint "AOT Compile" "${G}PASSED${N}";
+	return 0;
+}
+
+test_types() {
+	report=$(${SLUG} --opt-report scripts/collatz.slg 2>&1 >/dev/null | grep "^types:")
+	warning=$(printf 'outn(1 + true);\n' | ${SLUG} 2>&1 | head -n 1)
+	for f in scripts/*.slg; do
+		[ "${f}" = "scripts/pure_diag.slg" ] && continue
+		[ "$(${SLUG} -O0 "${f}" 2>/dev/null)" = "$(${SLUG} "${f}" 2>/dev/null)" ] || report=""
+	done
+	[ "${report}" = "types: 14 of 14 operand checks proven" ] && [ "${warning}" = "warning: operator '+' expects number, got boolean" ] && {
+		fprint "Type Inference" "${G}PASSED${N}";
+		return 0;
+	} || {
+		fprint "Type Inference" "${R}FAILED${N}";
+		return 20;
+	}
+}
+
+test_flat_closures() {
+	capture=$(printf '%s\n' \
+		'var cnt = func() => { var n = 0; func() => { n = n + 1; n; }; };' \
+		'var c1 = cnt(); var c2 = cnt(); c1(); c1(); outn(c1()); outn(c2());' \
+		'var mk = func(k) => { var inner = func() => { zz; }; var zz = k * 3; inner; };' \
+		'var r = mk(2); outn(r());' \
+		'var x = 1; var mk2 = func() => { func(x) => { x; }; }; var f = mk2(); outn(f(5)); outn(x);' | ${SLUG})
+	[ "$(echo ${capture})" = "3 1 6 5 5" ] && {
+		fprint "Flat Closures" "${G}PASSED${N}";
+		return 0;
+	} || {
+		fprint "Flat Closures" "${R}FAILED${N}";
+		return 21;
+	}
+}
+
+test_generators() {
+	capture=$(${SLUG} scripts/generators.slg)
+	exhausted=$(printf '%s\n' 'var one = func() => { yield 1; };' 'var g = one(); next(g); next(g);' | ${SLUG} 2>&1)
+	shadowed=$(printf '%s\n' 'var next = func(x) => x; outn(next(3));' 'var f = func(done) => done(4); outn(f(func(x) => x));' | ${SLUG} 2>&1)
+	local_next=$(printf '%s\n' 'var f = func() => { var next = 5; next; };' 'var one = func() => { yield 1; };' 'var g = one(); outn(next(g)); outn(f());' | ${SLUG} 2>&1)
+	[ "$(echo ${capture})" = "2 4 6 8 10 true" ] && [ "${exhausted}" = "runtime error: next on a finished generator" ] && [ "$(echo ${shadowed})" = "3 4" ] && [ "$(echo ${local_next})" = "1 5" ] && {
+		fprint "Generators" "${G}PASSED${N}";
+		return 0;
+	} || {
+		fprint "Generators" "${R}FAILED${N}";
+		return 22;
+	}
+}
+
+test_image() {
+	dir=$(mktemp -d)
+	printf '%s\n' 'var sq = func(n) => n * n;' 'var mk = func() => { var c = 0; func() => { c = c + 1; c; }; };' \
+		'var counter = mk(); counter();' 'const limit = 3;' > "${dir}/prelude.slg"
+	printf '%s\n' 'outn(sq(7)); outn(counter()); outn(limit);' 'var sq = func(n) => n + 1; outn(sq(limit));' > "${dir}/job.slg"
+	${SLUG} --snapshot "${dir}/prelude.slg" -o "${dir}/prelude.img" >/dev/null
+	capture=$(${SLUG} --image "${dir}/prelude.img" "${dir}/job.slg" 2>&1)
+	expected=$(cat "${dir}/prelude.slg" "${dir}/job.slg" | ${SLUG} 2>&1)
+	printf '\377' | dd of="${dir}/prelude.img" bs=1 seek=8 conv=notrunc 2>/dev/null
+	stale=$(${SLUG} --image "${dir}/prelude.img" "${dir}/job.slg" 2>&1)
+	rm -rf "${dir}"
+	[ "$(echo ${capture})" = "49 2 3 4" ] && [ "${capture}" = "${expected}" ] && [ "${stale}" = "runtime error: ${dir}/prelude.img was written by an incompatible slug build" ] && {
+		fprint "Heap Image" "${G}PASSED${N}";
+		return 0;
+	} || {
+		fprint "Heap Image" "${R}FAILED${N}";
+		return 23;
+	}
+}
+
+test_import() {
+	dir=$(mktemp -d)
+	mkdir "${dir}/lib"
+	printf '%s\n' 'import "util.slg";' 'var sq = func(n) => n * n;' > "${dir}/lib/math.slg"
+	printf '%s\n' 'var twice = func(f, x) => f(f(x));' > "${dir}/lib/util.slg"
+	printf '%s\n' 'import "lib/math.slg";' 'import "lib/util.slg";' 'outn(twice(sq, 3));' > "${dir}/main.slg"
+	printf '%s\n' 'import "../loop.slg";' > "${dir}/lib/loop.slg"
+	printf '%s\n' 'import "lib/loop.slg";' > "${dir}/loop.slg"
+	first=$(SLUG_CACHE="${dir}/cache" ${SLUG} "${dir}/main.slg" 2>&1)
+	second=$(SLUG_CACHE="${dir}/cache" ${SLUG} --verbose "${dir}/main.slg" 2>&1 | grep -c "loaded from cache")
+	# a cache entry under the new source's name that holds the old module stands in for a hash collision
+	old=$(grep -l "util.slg" "${dir}"/cache/*.slm)
+	printf '%s\n' 'import "util.slg";' 'var sq = func(n) => n + n;' > "${dir}/lib/math.slg"
+	SLUG_CACHE="${dir}/cache" ${SLUG} "${dir}/main.slg" >/dev/null 2>&1
+	cp "${old}" "$(ls -t "${dir}"/cache/*.slm | head -n 1)"
+	collision=$(SLUG_CACHE="${dir}/cache" ${SLUG} "${dir}/main.slg" 2>&1)
+	circular=$(${SLUG} "${dir}/loop.slg" 2>&1)
+	rm -rf "${dir}"
+	[ "${first}" = "81" ] && [ "${second}" = "2" ] && [ "${collision}" = "12" ] && [ "${circular}" = "runtime error: circular import: ${dir}/loop.slg -> ${dir}/lib/loop.slg -> ${dir}/loop.slg" ] && {
+		fprint "Modules" "${G}PASSED${N}";
+		return 0;
+	} || {
+		fprint "Modules" "${R}FAILED${N}";
+		return 24;
+	}
+}
+
+test_profile() {
+	out=$(mktemp)
+	${SLUG} --sample-profile=10000 --profile-out="${out}" scripts/ackermann.slg >/dev/null
+	total=$(grep -c "" "${out}")
+	valid=$(grep -cE '^(main:[0-9]+|\.\.\.)(;[A-Za-z_@0-9]+:[0-9]+)* [0-9]+$' "${out}")
+	deep=$(grep -c '^main:13;ackermann:[0-9]*;ackermann:' "${out}")
+	rm -f "${out}"
+	[ "${total}" -gt 0 ] && [ "${valid}" = "${total}" ] && [ "${deep}" -gt 0 ] && {
+		fprint "Sampling Profiler" "${G}PASSED${N}";
+		return 0;
+	} || {
+		fprint "Sampling Profiler" "${R}FAILED${N}";
+		return 25;
+	}
+}
+
+test_maps() {
+	capture=$(${SLUG} scripts/maps.slg)
+	missing=$(printf '%s\n' 'var m = {1: 2, true: 3};' 'm[4] = 5;' 'outn(m[true] + m[4]);' 'm[2];' | ${SLUG} 2>&1)
+	shadowed=$(printf '%s\n' 'var get = func() => 1; outn(get());' 'var size = func(n) => n * 2; outn(size(3));' 'var set = func(a, b) => a + b; outn(set(1, 2));' | ${SLUG} 2>&1)
+	scoped=$(printf '%s\n' 'var m = {1: 2}; var area = func(w) => { var size = w * w; size; }; outn(area(3)); outn(size(m));' 'var f = func() => { if (false) { var get = 0; } 1; }; outn(get(m, 1));' | ${SLUG} 2>&1)
+	grown=$(printf '%s\n' 'var m = {};' 'for i in 0..100000 { m[i] = i; }' 'outn(size(m));' | ${SLUG} --max-heap 5M 2>&1)
+	[ "$(echo ${capture})" = "871 178 2228 true null" ] && [ "$(echo ${missing})" = "8 runtime error: key not in map" ] && [ "$(echo ${shadowed})" = "1 6 3" ] && [ "$(echo ${scoped})" = "9 1 2" ] && [ "${grown}" = "100000" ] && {
+		fprint "Maps" "${G}PASSED${N}";
+		return 0;
+	} || {
+		fprint "Maps" "${R}FAILED${N}";
+		return 26;
+	}
+}
+
+test_perf() {
+	out=$(mktemp)
+	capture=$(${SLUG} --perf-counters=statements scripts/ackermann.slg 2>"${out}")
+	rows=$(grep -c -e '^tokenize ' -e '^parse ' -e '^line 13 ' -e '^total ' -e '^perf counters: unavailable' "${out}")
+	rm -f "${out}"
+	[ "${capture}" = "1021" ] && { [ "${rows}" = "4" ] || [ "${rows}" = "1" ]; } && {
+		fprint "Perf Counters" "${G}PASSED${N}";
+		return 0;
+	} || {
+		fprint "Perf Counters" "${R}FAILED${N}";
+		return 27;
+	}
+}
+
 #TODO: add verification functions for church_numerals.slg & collatz.slg & palindrome_checker.slg & godel.slg
 
-{ test_ackermann && test_increment && test_core_lang && test_turing && test_hof && test_recursion && test_demorgan && test_truth && test_entscheidungs && test_halting && test_purediag; ret="${?}"; } || exit 1
+{ test_ackermann && test_increment && test_core_lang && test_turing && test_hof && test_recursion && test_demorgan && test_truth && test_entscheidungs && test_halting && test_purediag && test_flat_block && test_budget && test_counted_loop && test_repl && test_stats && test_inline && test_aot && test_types && test_flat_closures && test_generators && test_image && test_import && test_profile && test_maps && test_perf; ret="${?}"; } || exit 1
 
 [ "${ret}" -eq 0 ] 2>/dev/null || printf "%s\n" "${ret}"